@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: MIT
+//
+// Measures loading, looking up, reloading and unloading the modules of
+// a directory, usually generated by bench/gen_modules.sh, in both
+// namespace modes. Prints one JSON object per line and mode.
+//
+// Usage: bench <modules_dir> [reloads] [lookups]
+
+#define MICRO_MODULE_STATS
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+// Drops the files of [dir] from the page cache, so that the next load
+// reads them from the disk
+static size_t evict(const char *dir, char *first_path, size_t path_size)
+{
+  DIR *d = opendir(dir);
+  if (!d) return 0;
+  size_t count = 0;
+  struct dirent *entry;
+  char path[4096];
+  while ((entry = readdir(d)))
+  {
+    if (entry->d_name[0] == '.') continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) continue;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    if (count++ == 0)
+      snprintf(first_path, path_size, "%s", path);
+  }
+  closedir(d);
+  return count;
+}
+
+static void print_phases(const MicroModuleStats *stats)
+{
+  static const char *names[MICRO_MODULE_PHASE_COUNT] = {
+    "scan", "check", "open", "symbols", "init", "exit", "close", "warm_up",
+  };
+  printf("\"phases_ns\":{");
+  for (int i = 0; i < MICRO_MODULE_PHASE_COUNT; ++i)
+    printf("%s\"%s\":%llu", i ? "," : "", names[i],
+           (unsigned long long)stats->phases[i].total_ns);
+  printf("}");
+}
+
+// Runs the whole benchmark in one namespace mode
+static void run(char *dir, bool new_namespace,
+                unsigned long reloads, unsigned long lookups)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       new_namespace);
+
+  char reload_path[4096] = "";
+  size_t files = evict(dir, reload_path, sizeof(reload_path));
+  printf("{\"modules\":%zu,\"new_namespace\":%s,",
+         files, new_namespace ? "true" : "false");
+
+  // Cold start without reading the files ahead first
+  mm.warm_up = false;
+  uint64_t start = now_ns();
+  int err = micro_module_init_all(&mm, dir, NULL);
+  uint64_t cold_no_warm_up_ns = now_ns() - start;
+  micro_module_exit_all(&mm, NULL);
+  mm.warm_up = true;
+  evict(dir, reload_path, sizeof(reload_path));
+  micro_module_stats_reset(&mm);
+
+  // Cold start, from the disk
+  start = now_ns();
+  if (err == MICRO_MODULE_OK)
+    err = micro_module_init_all(&mm, dir, NULL);
+  uint64_t cold_ns = now_ns() - start;
+  if (err != MICRO_MODULE_OK)
+  {
+    // Out of namespaces or memory, report why
+    printf("\"error\":%d}\n", err);
+    micro_module_exit_all(&mm, NULL);
+    return;
+  }
+  MicroModuleStats cold_stats;
+  micro_module_stats(&mm, NULL, &cold_stats);
+
+  // Lookups, round robin over the loaded names
+  size_t count = mm.index ? mm.index->count : 0;
+  const char **names = malloc((count ? count : 1) * sizeof(char*));
+  size_t n = 0;
+  for (MicroModuleList *it = mm.modules; it; it = it->next)
+    names[n++] = it->module.name;
+  size_t found = 0;
+  start = now_ns();
+  for (unsigned long i = 0; i < lookups && n > 0; ++i)
+    found += micro_module_get(&mm, names[i % n]) != NULL;
+  uint64_t lookup_ns = now_ns() - start;
+  free(names);
+
+  // Reloads of a single module. Opening the same file again in the
+  // same namespace would only return the loaded handle, so each reload
+  // opens its own copy of the file.
+  unsigned long reloaded = 0;
+  mm.shadow_copy = true;
+  start = now_ns();
+  while (reloaded < reloads && reload_path[0]
+         && micro_module_init(&mm, reload_path, NULL) == MICRO_MODULE_OK)
+    reloaded++;
+  uint64_t reload_ns = now_ns() - start;
+  mm.shadow_copy = false;
+
+  // Reloads of the same module, skipped since its file did not change
+  unsigned long skipped = 0;
+  mm.skip_unchanged = true;
+  start = now_ns();
+  while (skipped < reloads && reload_path[0]
+         && micro_module_init(&mm, reload_path, NULL) == MICRO_MODULE_OK)
+    skipped++;
+  uint64_t skipped_reload_ns = now_ns() - start;
+  mm.skip_unchanged = false;
+
+  start = now_ns();
+  micro_module_exit_all(&mm, NULL);
+  uint64_t unload_ns = now_ns() - start;
+
+  // Warm starts, from the page cache
+  start = now_ns();
+  micro_module_init_all(&mm, dir, NULL);
+  uint64_t warm_ns = now_ns() - start;
+  micro_module_exit_all(&mm, NULL);
+
+  start = now_ns();
+  micro_module_init_all_parallel(&mm, dir, NULL, 0);
+  uint64_t warm_parallel_ns = now_ns() - start;
+  micro_module_exit_all(&mm, NULL);
+
+  printf("\"cold_ns\":%llu,\"cold_no_warm_up_ns\":%llu,\"warm_ns\":%llu,\"warm_parallel_ns\":%llu,"
+         "\"reloads\":%lu,\"reload_ns\":%llu,\"skipped_reload_ns\":%llu,"
+         "\"unload_ns\":%llu,"
+         "\"lookups\":%lu,"
+         "\"lookups_found\":%zu,\"lookups_per_sec\":%.0f,",
+         (unsigned long long)cold_ns,
+         (unsigned long long)cold_no_warm_up_ns,
+         (unsigned long long)warm_ns,
+         (unsigned long long)warm_parallel_ns,
+         reloaded,
+         (unsigned long long)(reloaded ? reload_ns / reloaded : 0),
+         (unsigned long long)(skipped ? skipped_reload_ns / skipped : 0),
+         (unsigned long long)unload_ns,
+         lookups, found,
+         lookup_ns ? lookups * 1e9 / (double)lookup_ns : 0.0);
+  print_phases(&cold_stats);
+  printf("}\n");
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s <modules_dir> [reloads] [lookups]\n", argv[0]);
+    return 1;
+  }
+  unsigned long reloads = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+  unsigned long lookups = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000000;
+
+  run(argv[1], false, reloads, lookups);
+  run(argv[1], true, reloads, lookups);
+  return 0;
+}
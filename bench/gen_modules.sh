@@ -0,0 +1,82 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+#
+# Generates and compiles synthetic modules for bench/bench.c
+#
+# Usage: gen_modules.sh <dir> <count> <funcs> <relocs> <ctor_loops>
+#
+#   dir         Where to put the modules, its files are replaced. The
+#               sources go to <dir>.src
+#   count       Number of modules
+#   funcs       Functions per module, to grow its text
+#   relocs      Pointers per module needing a relocation at load time,
+#               half to its own functions and half to libc symbols
+#   ctor_loops  Iterations of a busy loop run by a constructor of each
+#               module, to mimic initialization of static state
+#
+# The modules are only regenerated when the parameters changed.
+
+set -e
+
+if [ $# -ne 5 ]; then
+  echo "usage: $0 <dir> <count> <funcs> <relocs> <ctor_loops>" >&2
+  exit 1
+fi
+
+DIR=$1
+COUNT=$2
+FUNCS=$3
+RELOCS=$4
+CTOR_LOOPS=$5
+CC=${CC:-gcc}
+JOBS=${JOBS:-$(nproc 2>/dev/null || echo 4)}
+
+PARAMS="$COUNT $FUNCS $RELOCS $CTOR_LOOPS $CC"
+if [ -f "$DIR.src/params" ] && [ "$(cat "$DIR.src/params")" = "$PARAMS" ]; then
+  exit 0
+fi
+
+rm -rf "$DIR" "$DIR.src"
+mkdir -p "$DIR" "$DIR.src"
+
+awk -v dir="$DIR.src" -v count="$COUNT" -v funcs="$FUNCS" \
+    -v relocs="$RELOCS" -v ctor_loops="$CTOR_LOOPS" '
+BEGIN {
+  split("strlen memcpy memset strcmp malloc free qsort printf", libc, " ")
+  for (id = 0; id < count; ++id) {
+    out = dir "/bench_module_" id ".c"
+    print "#include <stdio.h>" > out
+    print "#include <stdlib.h>" > out
+    print "#include <string.h>\n" > out
+    for (f = 0; f < funcs; ++f) {
+      printf "int bench_fn_%d(int x)\n{\n", f > out
+      printf "  for (int i = 0; i < %d; ++i)\n", 8 + f % 8 > out
+      printf "    x = x * %d + (x >> %d) + i;\n", 31 + f, 1 + f % 7 > out
+      print "  return x;\n}\n" > out
+    }
+    if (relocs > 0) {
+      print "void *bench_relocs[] = {" > out
+      for (r = 0; r < relocs; ++r) {
+        if (r % 2 == 0 && funcs > 0)
+          printf "  (void*)bench_fn_%d,\n", int(r / 2) % funcs > out
+        else
+          printf "  (void*)%s,\n", libc[int(r / 2) % 8 + 1] > out
+      }
+      print "};\n" > out
+    }
+    print "static volatile unsigned long bench_ctor_sink;\n" > out
+    print "__attribute__((constructor)) static void bench_ctor(void)\n{" > out
+    printf "  for (unsigned long i = 0; i < %sUL; ++i)\n", ctor_loops > out
+    print "    bench_ctor_sink += i;\n}\n" > out
+    printf "const char micro_module_name[] = \"bench_module_%d\";\n\n", id > out
+    print "int micro_module_init(void *arg)\n{\n  (void)arg;\n  return 0;\n}\n" > out
+    print "int micro_module_exit(void *arg)\n{\n  (void)arg;\n  return 0;\n}" > out
+    close(out)
+  }
+}'
+
+ls "$DIR.src" | sed -n 's/\.c$//p' \
+  | xargs -P "$JOBS" -I{} \
+      $CC -O1 -fPIC -shared "$DIR.src/{}.c" -o "$DIR/{}.so"
+
+echo "$PARAMS" > "$DIR.src/params"
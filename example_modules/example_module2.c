@@ -23,12 +23,14 @@ const char micro_module_name[] = "example_module2";
 
 extern int micro_module_init(void* arg)
 {
+  (void)arg;
   hello_message();
   return 0;
 }
 
 extern int micro_module_exit(void* arg)
 {
+  (void)arg;
   bye_message();
   return 0;
 }
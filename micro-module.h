@@ -140,11 +140,114 @@ extern "C" {
   #include <stdlib.h>
   #define MICRO_MODULE_FREE free
 #endif
+
+// Config: Number of bytes of a module name stored inline in the hash
+// index, including the terminator
+// Notes: Longer names still work, they are just compared through the
+// module entry after the inline prefix matched
+#ifndef MICRO_MODULE_NAME_INLINE
+  #define MICRO_MODULE_NAME_INLINE 48
+#endif
+
+// Config: Initial number of slots of the module hash index
+// Notes: Must be a power of two
+#ifndef MICRO_MODULE_INDEX_CAPACITY
+  #define MICRO_MODULE_INDEX_CAPACITY 16
+#endif
+
+// Config: Number of registry nodes in the first slab
+// Notes: Each further slab is twice as large as the previous one
+#ifndef MICRO_MODULE_SLAB_CAPACITY
+  #define MICRO_MODULE_SLAB_CAPACITY 16
+#endif
+
+// Config: Maximum length of the ELF build-id recorded for a module
+#ifndef MICRO_MODULE_BUILD_ID_MAX
+  #define MICRO_MODULE_BUILD_ID_MAX 32
+#endif
+
+// Config: Initial number of slots of the symbol cache of a module
+// Notes: Must be a power of two
+#ifndef MICRO_MODULE_SYM_CAPACITY
+  #define MICRO_MODULE_SYM_CAPACITY 8
+#endif
+
+// Config: Number of readers that can be inside
+// micro_module_read_lock at the same time in concurrent mode
+// Notes: More readers wait for a free slot
+#ifndef MICRO_MODULE_MAX_READERS
+  #define MICRO_MODULE_MAX_READERS 64
+#endif
+
+// Config: Number of counters the in-flight calls of a module are
+// spread over, see micro_module_enter
+#ifndef MICRO_MODULE_REF_SHARDS
+  #define MICRO_MODULE_REF_SHARDS 16
+#endif
+
+// Config: Maximum number of threads used by the parallel functions
+#ifndef MICRO_MODULE_MAX_THREADS
+  #define MICRO_MODULE_MAX_THREADS 64
+#endif
+
+// Config: Number of link-map namespaces a MicroModule may create
+// when MicroModule.use_new_namespace is set
+// Notes: glibc has 16 namespaces for the whole process, including the
+// main one, and never frees them. Each one loads its own C library,
+// whose TLS usually exhausts the static TLS block after about ten.
+#ifndef MICRO_MODULE_MAX_NAMESPACES
+  #define MICRO_MODULE_MAX_NAMESPACES 8
+#endif
+
+// Config: Alignment of the module images in the bundles written by
+// micro_module_write_bundle
+#ifndef MICRO_MODULE_BUNDLE_ALIGN
+  #define MICRO_MODULE_BUNDLE_ALIGN 4096
+#endif
+
+// Config: Define MICRO_MODULE_STATS to time each phase of loading and
+// unloading modules, see micro_module_stats
+// Notes: When it is not defined, no timing code is compiled
   
 //
 // Macros
 //
 
+// State of a module entry
+#define MICRO_MODULE_STATE_LOADED  0  // Opened and initialized
+#define MICRO_MODULE_STATE_LAZY    1  // Registered, opened on first use
+#define MICRO_MODULE_STATE_LOADING 2  // Being opened on first use
+#define MICRO_MODULE_STATE_FAILED  3  // Failed to load on first use
+
+// State of an asynchronous load, see micro_module_init_async
+#define MICRO_MODULE_LOAD_QUEUED  0  // Waiting for the worker
+#define MICRO_MODULE_LOAD_RUNNING 1  // Being loaded
+#define MICRO_MODULE_LOAD_DONE    2  // Loaded, failed or canceled
+
+// Changes applied by micro_module_sync
+#define MICRO_MODULE_CHANGE_ADDED    0
+#define MICRO_MODULE_CHANGE_RELOADED 1
+#define MICRO_MODULE_CHANGE_REMOVED  2
+
+// How modules are assigned to namespaces, see
+// MicroModule.namespace_policy
+#define MICRO_MODULE_NAMESPACE_SPREAD    0  // Least used namespace
+#define MICRO_MODULE_NAMESPACE_EXCLUSIVE 1  // One namespace per module
+#define MICRO_MODULE_NAMESPACE_SHARED    2  // All in a single namespace
+
+// Phases timed with MICRO_MODULE_STATS
+#define MICRO_MODULE_PHASE_SCAN    0  // Reading a modules directory
+#define MICRO_MODULE_PHASE_CHECK   1  // Checking and reading ahead a file
+#define MICRO_MODULE_PHASE_OPEN    2  // dlmopen, with relocations and
+                                      // constructors
+#define MICRO_MODULE_PHASE_SYMBOLS 3  // Looking up the symbols
+#define MICRO_MODULE_PHASE_INIT    4  // The init function
+#define MICRO_MODULE_PHASE_EXIT    5  // The exit function
+#define MICRO_MODULE_PHASE_CLOSE   6  // dlclose
+#define MICRO_MODULE_PHASE_WARM_UP 7  // Reading ahead a directory or
+                                      // a bundle
+#define MICRO_MODULE_PHASE_COUNT   8
+
 //
 // Errors
 //
@@ -161,18 +264,172 @@ extern "C" {
 #define MICRO_MODULE_ERROR_ALLOCATING_MEMORY     -9
 #define MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED -10
 #define MICRO_MODULE_ERROR_ARG_NULL              -11
-#define _MICRO_MODULE_ERROR_MAX                  -12
+#define MICRO_MODULE_ERROR_MISSING_DEPENDENCY    -12
+#define MICRO_MODULE_ERROR_DEPENDENCY_CYCLE      -13
+#define MICRO_MODULE_ERROR_NAME_MISMATCH         -14
+#define MICRO_MODULE_ERROR_NOT_A_MODULE          -15
+#define MICRO_MODULE_ERROR_WRITING_MANIFEST      -16
+#define MICRO_MODULE_ERROR_WATCHING_MODULES_DIR  -17
+#define MICRO_MODULE_ERROR_LOCATING_SYMBOL       -18
+#define MICRO_MODULE_ERROR_NO_NAMESPACE          -19
+#define MICRO_MODULE_ERROR_BAD_BUNDLE            -20
+#define MICRO_MODULE_ERROR_CANCELED              -21
+#define _MICRO_MODULE_ERROR_MAX                  -22
 
 //
 // Types
 //
 
 #include <stdbool.h>
-  
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
 // Init and exit functions
 typedef int(*micro_module_init_fn)(void*);
 typedef int(*micro_module_exit_fn)(void*);
 
+// Called with a file skipped by a directory loader, the
+// MICRO_MODULE_ERROR_ explaining why, and a user argument
+typedef void(*micro_module_skip_fn)(const char* path, int error, void* arg);
+
+// Called by micro_module_sync for each module of [path] that was
+// added, reloaded or removed, [change] being a MICRO_MODULE_CHANGE_,
+// with a user argument
+typedef void(*micro_module_change_fn)(const char* path,
+                                      const char* module_name,
+                                      int change,
+                                      void* arg);
+
+// Returns the isolation group of the module in [path] given a user
+// argument, or NULL if it has none, see MicroModule.group_fn
+typedef const char*(*micro_module_group_fn)(const char* path, void* arg);
+
+// Identity of a module file
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t size;
+  // ELF build-id of the file, if known
+  unsigned char build_id[MICRO_MODULE_BUILD_ID_MAX];
+  size_t build_id_length;
+} MicroModuleFileId;
+
+struct MicroModule;
+
+#ifdef MICRO_MODULE_STATS
+
+// Timings of a phase, in nanoseconds of CLOCK_MONOTONIC
+typedef struct {
+  uint64_t count;
+  uint64_t last_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t total_ns;
+} MicroModulePhaseStats;
+
+// Statistics of a module or of a whole MicroModule
+typedef struct {
+  // Indexed by MICRO_MODULE_PHASE_
+  MicroModulePhaseStats phases[MICRO_MODULE_PHASE_COUNT];
+  // Modules initialized successfully
+  uint64_t loads;
+  // Loads that replaced a module of the same name
+  uint64_t reloads;
+  // Modules exited by micro_module_exit or micro_module_exit_all
+  uint64_t unloads;
+} MicroModuleStats;
+
+#endif // MICRO_MODULE_STATS
+
+// Number of calls in flight in a module from the threads of a shard
+typedef struct {
+  uint64_t count;
+  // Keeps shards on their own cache line
+  char padding[64 - sizeof(uint64_t)];
+} MicroModuleRefShard;
+
+// In-flight calls of a loaded module, see micro_module_enter
+//
+// When a module is closed while calls are still in flight, what the
+// close would have released is kept here instead, and released by
+// micro_module_reap once the calls drained.
+typedef struct MicroModuleRefs MicroModuleRefs;
+struct MicroModuleRefs {
+  MicroModuleRefShard shards[MICRO_MODULE_REF_SHARDS];
+  // Set once the module is being unloaded, new calls are refused
+  bool closing;
+  // Registry the module belongs to
+  struct MicroModule *mm;
+  // What is left to release once drained
+  void *dlhandler;
+  char *path;
+  int memfd;
+  void **fns;
+  struct MicroModuleSymCache *syms;
+  // Next module waiting to drain
+  MicroModuleRefs *next;
+};
+
+// A call in flight in a module, see micro_module_enter
+typedef struct {
+  uint64_t *count;
+  // MicroModuleEntry.fns of the module, valid until the call ends even
+  // if the entry goes away
+  void **fns;
+} MicroModuleCall;
+
+// A stable slot holding the address of a symbol of a module, which
+// follows the module across reloads, see micro_module_stub
+typedef struct MicroModuleStub MicroModuleStub;
+struct MicroModuleStub {
+  // Address of the symbol, NULL while the module is not loaded or does
+  // not define it. Read it with MICRO_MODULE_STUB_ADDRESS.
+  void *address;
+  // Hash of [module_name]
+  uint32_t hash;
+  char *module_name;
+  char *symbol;
+  MicroModuleStub *next;
+};
+
+// Current address of the symbol of [stub], to be cast to its type
+#define MICRO_MODULE_STUB_ADDRESS(stub) \
+  __atomic_load_n(&(stub)->address, __ATOMIC_ACQUIRE)
+
+// A symbol of MicroModule.symbols
+typedef struct {
+  const char *name;
+  // Whether modules must define it, otherwise loading them fails with
+  // MICRO_MODULE_ERROR_LOCATING_SYMBOL
+  bool required;
+} MicroModuleSymbol;
+
+// A symbol resolved through micro_module_sym
+typedef struct {
+  uint32_t hash;
+  // Copy of the symbol name, NULL while the slot is free
+  char *symbol;
+  // Address of the symbol, NULL if the module does not define it
+  void *address;
+} MicroModuleSymSlot;
+
+// Open addressing cache of the symbols of a module. It is replaced by
+// a bigger one when it fills up, the old one being kept until the
+// module is closed since readers do not take any lock.
+typedef struct MicroModuleSymCache MicroModuleSymCache;
+struct MicroModuleSymCache {
+  // Number of slots, a power of two
+  size_t capacity;
+  size_t count;
+  // The slots, allocated together with the cache
+  MicroModuleSymSlot *slots;
+  // The cache this one replaced
+  MicroModuleSymCache *retired;
+};
+
 // Struct representing a single module
 typedef struct {
   // Module name, used as an identifier
@@ -183,32 +440,403 @@ typedef struct {
   micro_module_exit_fn exit_fn;
   // The opaque handler returned from dlopen / dlmopen
   void* dlhandler;
+  // Whether the module exports MicroModule.independent_symbol, so its
+  // init function may run concurrently with other modules
+  bool independent;
+  // NULL terminated names of the modules this module depends on, as
+  // exported through MicroModule.deps_symbol, or NULL
+  const char *const *deps;
+  // Path the module was loaded from
+  char *path;
+  // Identity of the file at [path] when the module was loaded, with its
+  // build-id if the file was checked
+  MicroModuleFileId file_id;
+  // Sealed memfd holding the image of a module loaded with
+  // micro_module_init_mem, which [path] points to through
+  // /proc/self/fd, or 0. It stays open as long as the module does.
+  int memfd;
+  // One of MICRO_MODULE_STATE_, only the name and the path of a module
+  // that is not MICRO_MODULE_STATE_LOADED are valid
+  int state;
+  // Argument for the init function of a lazy module
+  void *init_arg;
+  // Symbols looked up through micro_module_sym, or NULL
+  MicroModuleSymCache *syms;
+  // Addresses of MicroModule.symbols, in the same order, resolved when
+  // the module is loaded. Optional symbols the module does not define
+  // are NULL.
+  void **fns;
+  // Calls in flight in the module, NULL if it is not loaded
+  MicroModuleRefs *refs;
+#ifdef MICRO_MODULE_STATS
+  // Statistics of the module, kept across reloads
+  MicroModuleStats stats;
+#endif
 } MicroModuleEntry;
 
+// Something unlinked from the registry in concurrent mode, waiting
+// for the readers that may still see it before being freed
+typedef struct MicroModuleRetired MicroModuleRetired;
+struct MicroModuleRetired {
+  MicroModuleRetired *next;
+  // Epoch at which it was unlinked
+  uint64_t epoch;
+  // Frees what embeds this
+  void (*free_fn)(struct MicroModule *mm, MicroModuleRetired *retired);
+};
+
 // Linked list of modules, where the head is the last loaded module
 struct MicroModuleList;
 typedef struct MicroModuleList MicroModuleList;
 struct MicroModuleList {
   MicroModuleList* next;
+  MicroModuleList* prev;
   MicroModuleEntry module;
+  // Used once the node was unlinked in concurrent mode
+  MicroModuleRetired retired;
+  // While a lazy module is MICRO_MODULE_STATE_LOADING, the thread
+  // loading it without holding MicroModule.lock, and the node that
+  // thread waits for, if any. [loaded] is broadcast once it is done.
+  pthread_t loader;
+  MicroModuleList *waiting;
+  pthread_cond_t loaded;
 };
 
-// Central struct of this library
+// A block of registry nodes, see MicroModule.slabs
+typedef struct MicroModuleSlab MicroModuleSlab;
+struct MicroModuleSlab {
+  MicroModuleSlab *next;
+  // Number of nodes
+  size_t capacity;
+  MicroModuleList nodes[];
+};
+
+// A link-map namespace created for the modules of a MicroModule
+typedef struct {
+  // Lmid_t of the namespace
+  long lmid;
+  // C library opened first in the namespace, which keeps it alive
+  void *anchor;
+  // Number of modules opened in it
+  size_t modules;
+  // Isolation group it belongs to, NULL for the modules without one
+  char *group;
+} MicroModuleNamespace;
+
+// Memory used by the namespaces of an isolation group, in bytes
 typedef struct {
-  // Linked list of modules
+  size_t namespaces;
+  size_t modules;
+  // Shared objects loaded in the namespaces, the C library and the
+  // dependencies of the modules included, but not those shared with
+  // the main namespace
+  size_t objects;
+  // Size of their segments
+  size_t size;
+  // From /proc/self/smaps
+  size_t rss;
+  size_t pss;
+  size_t private_dirty;
+} MicroModuleMemory;
+
+// A bundle packs many modules in a single file, see
+// micro_module_init_bundle. It starts with a MicroModuleBundleHeader,
+// followed by [count] MicroModuleBundleIndex and by the names of the
+// modules, each NUL terminated. The module images come next, each at
+// an offset aligned to MICRO_MODULE_BUNDLE_ALIGN. Integers are stored
+// in the byte order of the machine that wrote the bundle.
+#define MICRO_MODULE_BUNDLE_MAGIC   "MMBUNDLE"
+#define MICRO_MODULE_BUNDLE_VERSION 1
+
+typedef struct {
+  // MICRO_MODULE_BUNDLE_MAGIC, without the terminator
+  char magic[8];
+  uint32_t version;
+  // Number of modules
+  uint32_t count;
+  // Position and size of the names
+  uint64_t names_offset;
+  uint64_t names_size;
+} MicroModuleBundleHeader;
+
+// A module of a bundle
+typedef struct {
+  // Position and size of the image of the module in the bundle
+  uint64_t offset;
+  uint64_t size;
+  // 64 bit FNV-1a hash of the image
+  uint64_t hash;
+  // Position of the module name from the start of the names, and its
+  // length without the terminator
+  uint64_t name_offset;
+  uint64_t name_length;
+} MicroModuleBundleIndex;
+
+// Allocator of the memory owned by a MicroModule
+typedef struct {
+  // Returns [size] bytes aligned like malloc(3), or NULL
+  void *(*alloc)(void *ctx, size_t size);
+  // Frees what [alloc] returned, ignoring NULL
+  void (*free)(void *ctx, void *ptr);
+  // Passed to [alloc] and [free]
+  void *ctx;
+} MicroModuleAllocator;
+
+typedef struct MicroModuleLoad MicroModuleLoad;
+
+// Called when the asynchronous [load] completed with [result], a
+// MICRO_MODULE_ERROR_ or the value returned by the init function, and
+// a user argument
+typedef void(*micro_module_load_fn)(MicroModuleLoad *load,
+                                    int result,
+                                    void *arg);
+
+// An asynchronous load, see micro_module_init_async
+struct MicroModuleLoad {
+  struct MicroModule *mm;
+  // Copy of the path of the module
+  char *path;
+  // Argument of the init function
+  void *arg;
+  // Optional completion callback, and its argument
+  micro_module_load_fn done_fn;
+  void *done_arg;
+  // Eventfd that becomes readable once the load completed
+  int fd;
+  // One of MICRO_MODULE_LOAD_
+  int state;
+  // Result, valid once the state is MICRO_MODULE_LOAD_DONE
+  int result;
+  // Next queued load
+  MicroModuleLoad *next;
+};
+
+// A slot of the module hash index
+typedef struct {
+  // Precomputed hash of the module name
+  uint32_t hash;
+  // Length of the module name
+  uint32_t length;
+  // Inline copy of the name, truncated to MICRO_MODULE_NAME_INLINE - 1
+  char name[MICRO_MODULE_NAME_INLINE];
+  // Node of the module in the list, NULL if the slot was never used
+  MicroModuleList *node;
+} MicroModuleIndexSlot;
+
+// Open addressing hash index of the loaded modules, keyed by name
+//
+// Removed modules leave a tombstone behind, which is only cleared
+// when the index gets rehashed.
+typedef struct {
+  // Number of slots, always a power of two
+  size_t capacity;
+  // Number of live modules
+  size_t count;
+  // Number of live modules plus tombstones
+  size_t used;
+  // The slots, allocated together with the index
+  MicroModuleIndexSlot *slots;
+  // Used once the index was replaced in concurrent mode
+  MicroModuleRetired retired;
+} MicroModuleIndex;
+
+// A reader of a concurrent registry, see micro_module_read_lock
+typedef struct {
+  // Epoch at which the reader started, 0 if the slot is free
+  uint64_t epoch;
+  // Keeps readers on their own cache line
+  char padding[64 - sizeof(uint64_t)];
+} MicroModuleReader;
+
+// Central struct of this library
+typedef struct MicroModule {
+  // Linked list of modules, in load order
   MicroModuleList *modules;
+  // Hash index over [modules], used for lookups by name
+  MicroModuleIndex *index;
   // Symbol for a module name
   const char* name_symbol;
   // Symbol for the init function
   const char* init_fn_symbol;
   // Symbol for the exit function
   const char* exit_fn_symbol;
-  // Wether to create a new namespace of not
+  // Whether to create a new namespace or not
   // If a new namespace is created, the module will not be able
   // to access symbols from the loader.
   bool use_new_namespace;
+  // One of MICRO_MODULE_NAMESPACE_, how modules are assigned to the
+  // namespaces when [use_new_namespace] is set. Up to
+  // MICRO_MODULE_MAX_NAMESPACES namespaces are created on demand:
+  // - MICRO_MODULE_NAMESPACE_SPREAD, the default, puts a module in
+  //   the namespace holding the fewest modules, so that any number of
+  //   modules can be loaded
+  // - MICRO_MODULE_NAMESPACE_EXCLUSIVE gives each module a namespace
+  //   of its own, loading more modules than namespaces fails with
+  //   MICRO_MODULE_ERROR_NO_NAMESPACE
+  // - MICRO_MODULE_NAMESPACE_SHARED puts all the modules in one
+  //   namespace, which still isolates them from the loader
+  // In any case, a file or path loaded again while it is still loaded
+  // goes to another namespace, created if needed, as glibc would return
+  // the loaded copy even once the file was replaced, and the
+  // namespaces emptied by unloaded modules are reused. Since glibc
+  // never frees namespaces, they are kept for the life of the process.
+  int namespace_policy;
+  // Optional function putting modules in isolation groups, and its
+  // argument. The modules of a group share a namespace, and thus the
+  // C library and their dependencies, while they stay isolated from
+  // the other groups and from the modules without a group, which are
+  // placed by [namespace_policy]. See micro_module_memory.
+  micro_module_group_fn group_fn;
+  void* group_arg;
+  MicroModuleNamespace namespaces[MICRO_MODULE_MAX_NAMESPACES];
+  size_t namespaces_count;
+  // Optional symbol exported by modules whose init function does not
+  // depend on other modules, NULL if not used. Those modules are
+  // initialized concurrently by micro_module_init_all_parallel.
+  const char* independent_symbol;
+  // Optional symbol of a NULL terminated array of module names that a
+  // module depends on, NULL if not used:
+  //
+  //   const char *micro_module_deps[] = { "example_module1", NULL };
+  //
+  // When set, the _all functions initialize the modules of a directory
+  // after their dependencies and exit them before, calling the modules
+  // that do not depend on each other concurrently.
+  const char* deps_symbol;
+  // Optional table of additional symbols resolved when a module is
+  // loaded, and its length, NULL if not used. Index
+  // MicroModuleEntry.fns with the position of a symbol in the table:
+  //
+  //   enum { TICK, FLUSH };
+  //   static const MicroModuleSymbol symbols[] = {
+  //     [TICK]  = { "tick", true },
+  //     [FLUSH] = { "flush", false },
+  //   };
+  //   mm.symbols       = symbols;
+  //   mm.symbols_count = 2;
+  //   ...
+  //   ((void(*)(void))entry->fns[TICK])();
+  const MicroModuleSymbol* symbols;
+  size_t symbols_count;
+  // Whether to check files through their ELF headers before opening
+  // them, see micro_module_check. Files failing the check are skipped by
+  // the directory loaders instead of being opened. On by default.
+  bool check_files;
+  // Optional function called with the files skipped by the directory
+  // loaders, and its argument
+  micro_module_skip_fn skip_fn;
+  void* skip_arg;
+  // Optional function called with the changes made by
+  // micro_module_sync, and its argument
+  micro_module_change_fn change_fn;
+  void* change_arg;
+  // Whether micro_module_init_all_parallel asks the kernel to read all
+  // the files ahead before opening the first one, and
+  // micro_module_init_bundle the whole bundle, so that dlmopen finds
+  // them in the page cache instead of faulting them in page by page.
+  // On by default.
+  bool warm_up;
+  // Optional path of a manifest caching what micro_module_init_all
+  // learned about a directory, NULL if not used. See
+  // micro_module_init_all_parallel.
+  const char* manifest_path;
+  // Whether micro_module_init reloads a module by initializing the new
+  // version before exiting the old one, see micro_module_init
+  bool staged_reload;
+  // Whether micro_module_init leaves a module alone if its file did
+  // not change since it was loaded, see micro_module_init. Off by
+  // default.
+  bool skip_unchanged;
+  // Whether modules are loaded from a snapshot of their file instead
+  // of the file itself, see micro_module_init. Off by default.
+  bool shadow_copy;
+  // How long unloading a module waits for the calls in flight in it to
+  // drain, in milliseconds, see micro_module_enter. 0 by default.
+  unsigned int drain_timeout_ms;
+  // Modules closed while calls were in flight, see micro_module_reap
+  MicroModuleRefs *draining;
+  // Stubs handed out by micro_module_stub
+  MicroModuleStub *stubs;
+  // Allocator of everything [mm] owns. Left unset, MICRO_MODULE_MALLOC
+  // and MICRO_MODULE_FREE are used. Only change it while nothing is
+  // loaded.
+  MicroModuleAllocator allocator;
+  // Registry nodes are carved out of slabs, newest first, so that they
+  // stay close together. Freed nodes go to [free_nodes] to be reused,
+  // and the slabs are released by micro_module_exit_all.
+  MicroModuleSlab *slabs;
+  MicroModuleList *free_nodes;
+  // Number of nodes handed out of the slabs
+  size_t nodes_used;
+  // Loads queued by micro_module_init_async, oldest first, and the
+  // worker running them, which exits once the queue is empty
+  MicroModuleLoad *async_head;
+  MicroModuleLoad *async_tail;
+  pthread_t async_thread;
+  bool async_running;
+  // Whether [async_thread] exited or is running, and must be joined
+  bool async_joinable;
+  pthread_mutex_t async_lock;
+  // Signaled when a load completed
+  pthread_cond_t async_done;
+#ifdef MICRO_MODULE_STATS
+  // Totals of all modules, see micro_module_stats
+  MicroModuleStats stats;
+  pthread_mutex_t stats_lock;
+#endif
+  // Whether other threads read the registry while it is changed, see
+  // micro_module_read_lock. Off by default.
+  bool concurrent;
+  // Serializes the changes to the registry and the loading of lazy
+  // modules
+  pthread_mutex_t lock;
+  // Epoch based reclamation of concurrent mode: the current epoch, the
+  // readers and what they may still see
+  uint64_t epoch;
+  MicroModuleReader readers[MICRO_MODULE_MAX_READERS];
+  MicroModuleRetired *retired;
 } MicroModule;
 
+// What micro_module_sync did
+typedef struct {
+  size_t added;
+  size_t reloaded;
+  size_t removed;
+  size_t unchanged;
+  // Files that failed to load, or modules that failed to unload
+  size_t failed;
+} MicroModuleSyncReport;
+
+// A file of a watched directory that changed
+typedef struct {
+  // File name, relative to the directory
+  char *name;
+  // Whether the file went away, or was written
+  bool removed;
+} MicroModuleWatchChange;
+
+// A directory watched for changes, see micro_module_watch
+typedef struct {
+  MicroModule *mm;
+  // The watched directory, without trailing '/'
+  char *dir;
+  // Argument of the init and exit functions
+  void *arg;
+  // Milliseconds without new changes before they are applied
+  unsigned int debounce_ms;
+  // File descriptor to poll for readability, then call
+  // micro_module_watch_dispatch
+  int fd;
+  int inotify_fd;
+  int timer_fd;
+  // Whether events were lost and the directory must be loaded again
+  bool overflowed;
+  // Changes not applied yet, one per file in the order they happened
+  MicroModuleWatchChange *changes;
+  size_t changes_count;
+  size_t changes_capacity;
+} MicroModuleWatch;
+
 //
 // Function declarations
 //
@@ -221,22 +849,383 @@ micro_module_setup(const char* name_symbol,
                    const char* exit_fn_symbol,
                    bool use_new_namespace);
 
+// Checks that [filename] is a shared object for this machine that
+// defines the name, init and exit symbols of [mm], and its required
+// MicroModule.symbols, without opening it with dlmopen. The file is
+// mapped and only its ELF headers, dynamic section and symbol hash
+// table are read.
+//
+// Note that symbols provided by the dependencies of the module are not
+// seen by this check, unlike with dlsym.
+// Returns MICRO_MODULE_OK if the file looks like a module,
+// MICRO_MODULE_ERROR_NOT_A_MODULE if it is not a shared object for this
+// machine, or the MICRO_MODULE_ERROR_LOCATING_ error of the first
+// missing symbol
+MICRO_MODULE_DEF int
+micro_module_check(MicroModule *mm, const char* filename);
+
 // Load and initialize module located in [filename], passing [arg]
 //
 // If the module was already loaded, it first unloads it and then loads
-// it again.
+// it again. The module is registered only once its init function
+// returned 0, so micro_module_get finds no module of that name while
+// it is reloaded, nor after its init function failed, in which case it
+// is closed. If MicroModule.skip_unchanged is set, nothing is done if
+// the module loaded from [filename] still comes from the same file,
+// with the same device, inode, mtime and size, or with the same ELF
+// build-id when the file is checked. If the module declares
+// dependencies (see MicroModule.deps_symbol), they must be already
+// registered. If MicroModule.check_files is set, the file is checked
+// before being opened.
+//
+// If MicroModule.shadow_copy is set, the file is copied into a sealed
+// memfd which is checked and loaded instead, as micro_module_init_mem
+// does, while the entry keeps [filename] as its path. Every reload
+// then maps the bytes the file had when it was copied, even if it was
+// overwritten in place under the same path, which ld.so would
+// otherwise take for the loaded version. The file may also be
+// replaced while it is being loaded. This applies to everything built
+// on micro_module_init: async loads, micro_module_sync and the
+// watcher, and to the modules of micro_module_init_all and the lazy
+// modules too, whose files are checked before being copied.
+//
+// If MicroModule.staged_reload is set, a module already registered is
+// instead replaced only once the new version initialized: the new
+// version is opened and initialized while the old one keeps serving,
+// its entry is swapped in for the old one, and the old version is
+// exited and closed last. If the new version fails to initialize, it
+// is closed and the old one stays registered. Both versions are
+// initialized for a moment, so their init and exit functions must
+// tolerate it. This needs the two versions to be distinct instances:
+// dlmopen returns the loaded one for a file that is still loaded in
+// the same namespace, in which case the module is reloaded as if
+// staged_reload was not set. Set MicroModule.shadow_copy or
+// MicroModule.use_new_namespace to stage the reloads of a file
+// replaced under the same path.
 // Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
 MICRO_MODULE_DEF int
 micro_module_init(MicroModule *mm, char* filename, void* arg);
 
+// Load and initialize the module whose shared object image is the
+// [len] bytes at [buf], passing [arg], without writing it to the
+// filesystem
+//
+// The image is copied once into a sealed memfd named after
+// [name_hint], which may be NULL, and opened through /proc/self/fd.
+// The module is then registered, reloaded and unloaded like one loaded
+// with micro_module_init; its MicroModuleEntry.path is the /proc path
+// of the memfd, which stays open as long as the module is loaded.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_init_mem(MicroModule *mm,
+                      const char *name_hint,
+                      const void *buf,
+                      size_t len,
+                      void *arg);
+
+// Queues the loading of the module in [filename] like micro_module_init
+// with [arg], and returns right away a handle to the load, or NULL if
+// memory or file descriptors ran out
+//
+// The loads are run one at a time, in the order they were queued, by
+// a worker thread owned by [mm], which is started when needed and
+// exits once the queue is empty. When a load completes, [done_fn] is
+// called with [done_arg] from the worker, if not NULL, then
+// MicroModuleLoad.fd becomes readable. The result is then given by
+// micro_module_load_wait, and the handle must be released with
+// micro_module_load_free. micro_module_exit_all cancels the queued
+// loads and waits for the one running.
+MICRO_MODULE_DEF MicroModuleLoad*
+micro_module_init_async(MicroModule *mm,
+                        const char *filename,
+                        void *arg,
+                        micro_module_load_fn done_fn,
+                        void *done_arg);
+
+// Cancels [load] if it did not start yet. It then completes with
+// MICRO_MODULE_ERROR_CANCELED, its callback being called from the
+// calling thread.
+// Returns true if it was canceled
+MICRO_MODULE_DEF bool micro_module_load_cancel(MicroModuleLoad *load);
+
+// Waits for [load] to complete
+// Returns its result
+MICRO_MODULE_DEF int micro_module_load_wait(MicroModuleLoad *load);
+
+// Waits for [load] to complete and frees it. Must not be called from
+// its callback.
+MICRO_MODULE_DEF void micro_module_load_free(MicroModuleLoad *load);
+
+// Load and initialize all the modules of the bundle [path], passing
+// [arg]. See micro_module_init_bundle_modules.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_init_bundle(MicroModule *mm, const char *path, void *arg);
+
+// Load and initialize the modules of the bundle [path] named in the
+// NULL terminated [names], or all of them if [names] is NULL, passing
+// [arg]
+//
+// The bundle is opened and mapped once, and the modules are found
+// through its index without reading their ELF headers. Each image is
+// then loaded like with micro_module_init_mem. Modules are loaded in
+// the order of the bundle, except those whose dependencies are not
+// loaded yet, which are retried once the others are. The hash of each
+// image is checked before it is copied, once whatever the number of
+// retries.
+// Returns MICRO_MODULE_OK on success, MICRO_MODULE_ERROR_BAD_BUNDLE if
+// the bundle is malformed or an image does not match its hash,
+// MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED if a name is not in the
+// bundle, or another negative MICRO_MODULE_ERROR_ of the first module
+// that failed to load
+MICRO_MODULE_DEF int
+micro_module_init_bundle_modules(MicroModule *mm,
+                                 const char *path,
+                                 const char *const *names,
+                                 void *arg);
+
+// Writes the [count] module files [files] to the bundle [path], which
+// is replaced atomically. The files must pass micro_module_check, and
+// the bundle names the modules after their name symbol.
+// Returns MICRO_MODULE_OK on success, MICRO_MODULE_ERROR_BAD_BUNDLE if
+// two files define the same module or the bundle cannot be written, or
+// the error of the first file that is not a module
+MICRO_MODULE_DEF int
+micro_module_write_bundle(MicroModule *mm,
+                          const char *path,
+                          const char *const *files,
+                          size_t count);
+
 // Load and initialize all modules from [modules_dir], passing [arg]
 //
 // If a module was already loaded, it first unloads it and then loads
-// it again.
+// it again. This is micro_module_init_all_parallel with one thread.
 // Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
 MICRO_MODULE_DEF int
 micro_module_init_all(MicroModule *mm, char* modules_dir, void* arg);
 
+// Load and initialize all modules from [modules_dir] using up to
+// [nthreads] threads, passing [arg]. If [nthreads] is 0, one thread per
+// online CPU is used.
+//
+// Files failing the check of MicroModule.check_files are skipped and
+// reported to MicroModule.skip_fn.
+//
+// Reading and checking the files overlaps with dlmopen, and the init
+// functions of independent modules (see MicroModule.independent_symbol)
+// run on the worker threads while the other ones run in directory
+// order. The modules they replace are unloaded in directory order
+// before any is initialized, and each module is registered as soon as
+// its init function returned 0; if a file fails to load, the modules
+// before it are initialized and registered, the ones after it are
+// closed, and its error is returned.
+//
+// If MicroModule.manifest_path is set, the manifest is read first. If
+// it was written for the same directory, the directory did not change
+// since, and it was written with the same symbol names, the directory
+// is not walked and the files are taken from it. A file whose device,
+// inode, mtime and size still match the manifest is then opened
+// without being checked, and its symbols are found at the offsets
+// stored in the manifest instead of through dlsym. Files that changed
+// are loaded as usual. When anything changed, the manifest is written
+// again once all the modules loaded; failing to write it is not an
+// error. The manifest should not be kept in [modules_dir], as writing
+// it would change the directory.
+//
+// If MicroModule.deps_symbol is set, modules are initialized level by
+// level after the modules they depend on, and all the modules of a
+// level run concurrently. A dependency must be in the directory or
+// already registered. If an init function fails, its module and the
+// modules of the following levels are closed without being
+// registered, the latter without being initialized.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_init_all_parallel(MicroModule *mm,
+                               char* modules_dir,
+                               void* arg,
+                               unsigned int nthreads);
+
+// Register the module located in [filename] without opening it. The
+// module is loaded and initialized with [arg] the first time it is
+// requested through micro_module_get.
+//
+// The module is registered as [module_name]. If [module_name] is NULL,
+// the name is read from the file when MicroModule.check_files is set,
+// otherwise the file name up to the first '.' is used. When it gets
+// loaded, the name it exports must match, otherwise loading fails with
+// MICRO_MODULE_ERROR_NAME_MISMATCH. If a module with the same name was
+// already loaded, it is unloaded first.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_init_lazy(MicroModule *mm,
+                       char* filename,
+                       const char* module_name,
+                       void* arg);
+
+// Register all modules from [modules_dir] without opening them, see
+// micro_module_init_lazy. Files failing the check of
+// MicroModule.check_files are skipped and reported to
+// MicroModule.skip_fn.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_init_all_lazy(MicroModule *mm, char* modules_dir, void* arg);
+
+// Returns the module identified by [module_name], or NULL if no such
+// module is registered
+//
+// A lazy module is loaded and initialized by the first call, without
+// holding the lock of the registry, and other threads asking for it
+// at the same time wait for it to be ready. NULL is returned if it
+// failed to load, in which case it is not tried again until it is
+// registered again, and to the thread loading it, from its init
+// function.
+MICRO_MODULE_DEF MicroModuleEntry*
+micro_module_get(MicroModule *mm, const char *module_name);
+
+// Returns the address of [symbol] in the loaded [module], or NULL if
+// it does not define it
+//
+// Results are cached in the module, so only the first lookup of a
+// symbol goes through dlsym, and the following ones are a hash probe
+// without any lock. The cache goes away with the module when it is
+// unloaded or reloaded, so addresses must not be kept past that.
+MICRO_MODULE_DEF void*
+micro_module_sym(MicroModule *mm,
+                 MicroModuleEntry *module,
+                 const char *symbol);
+
+// Enters a read-side critical section of the registry, and returns
+// the reader to pass to micro_module_read_unlock
+//
+// When MicroModule.concurrent is set, micro_module_init,
+// micro_module_exit and the other functions changing the registry can
+// run on a control thread while other threads look modules up with
+// micro_module_get and walk them with micro_module_next, without
+// taking any lock. Readers must do so between micro_module_read_lock
+// and micro_module_read_unlock: a module unloaded or replaced in the
+// meantime is exited right away, but its node is freed and its handle
+// closed only once all the readers that could have seen it left.
+// Critical sections can nest, and must not call functions changing
+// the registry or micro_module_synchronize.
+MICRO_MODULE_DEF size_t micro_module_read_lock(MicroModule *mm);
+
+// Leaves the read-side critical section of [reader]
+MICRO_MODULE_DEF void micro_module_read_unlock(MicroModule *mm, size_t reader);
+
+// Returns the module after [it] in the registry, or the first one if
+// [it] is NULL, or NULL at the end. Lazy modules that were not loaded
+// yet are included.
+MICRO_MODULE_DEF MicroModuleList*
+micro_module_next(MicroModule *mm, MicroModuleList *it);
+
+// Waits until the modules unloaded so far in concurrent mode are
+// closed, that is until the readers that could still see them left
+MICRO_MODULE_DEF void micro_module_synchronize(MicroModule *mm);
+
+// Marks the start of a call into the loaded [module] of [mm], filling
+// [call]. Returns false if the module is not loaded or is being
+// unloaded, in which case it must not be called, and always if
+// MicroModule.concurrent is not set.
+//
+// Call guards need concurrent mode: the call must be entered within
+// micro_module_read_lock, which keeps the entry from being freed while
+// the call is being counted. The call then outlives the read-side
+// critical section.
+//
+// Until the call is ended with micro_module_leave, the code of the
+// module stays mapped: unloading the module first waits up to
+// MicroModule.drain_timeout_ms for the calls in flight to end before
+// calling its exit function, and if some are still running once it
+// exited, its handle is only closed later by micro_module_reap.
+//
+// The count is spread over MICRO_MODULE_REF_SHARDS cache lines picked
+// by thread, so that threads calling the same module do not contend.
+// Only the code of the module is kept: the entry itself may be freed
+// when the module is unloaded, use MicroModuleCall.fns to call it.
+MICRO_MODULE_DEF bool
+micro_module_enter(MicroModule *mm,
+                   MicroModuleEntry *module,
+                   MicroModuleCall *call);
+
+// Marks the end of [call]
+MICRO_MODULE_DEF void micro_module_leave(MicroModuleCall *call);
+
+// Closes the modules unloaded while calls were in flight in them,
+// whose calls have since ended.
+// Returns the number of modules still waiting for their calls
+MICRO_MODULE_DEF size_t micro_module_reap(MicroModule *mm);
+
+// Returns a stub for [symbol] of the module called [module_name], or
+// NULL if memory ran out. Asking twice for the same symbol returns the
+// same stub.
+//
+// The stub keeps the address of the symbol up to date: it is set when
+// the module finishes initializing, whether it was loaded before the
+// stub was created, later, lazily or by a reload, and reset to NULL
+// before the module is exited. With MicroModule.staged_reload, it
+// moves to the new version before the old one is exited. Callers can
+// bind to the stub once, and call through it on hot paths:
+//
+//   MicroModuleStub *tick = micro_module_stub(&mm, "game", "tick");
+//   ...
+//   void (*fn)(void) = (void(*)(void))MICRO_MODULE_STUB_ADDRESS(tick);
+//   if (fn) fn();
+MICRO_MODULE_DEF MicroModuleStub*
+micro_module_stub(MicroModule *mm,
+                  const char *module_name,
+                  const char *symbol);
+
+// Frees all the stubs of [mm], which must no longer be used
+MICRO_MODULE_DEF void micro_module_free_stubs(MicroModule *mm);
+
+#ifdef MICRO_MODULE_STATS
+
+// Copies into [stats] the statistics of the module called
+// [module_name], or the totals of [mm] if [module_name] is NULL. The
+// totals include the directory scans, the failed loads and the
+// modules no longer loaded.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_stats(MicroModule *mm,
+                   const char *module_name,
+                   MicroModuleStats *stats);
+
+// Clears the statistics of [mm] and of its modules
+MICRO_MODULE_DEF void micro_module_stats_reset(MicroModule *mm);
+
+#endif // MICRO_MODULE_STATS
+
+// Measures the memory used by the namespaces of the isolation group
+// [group] into [memory], or by the namespaces of the modules without a
+// group if [group] is NULL. Only meaningful with
+// MicroModule.use_new_namespace.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_memory(MicroModule *mm,
+                    const char *group,
+                    MicroModuleMemory *memory);
+
+// Brings the modules loaded from [modules_dir] in line with its
+// files, passing [arg] to the init and exit functions, and fills
+// [report] if it is not NULL
+//
+// The files are matched with the registry by path. Files without a
+// module are loaded, and the modules whose file is gone are unloaded.
+// A module whose file has a different device, inode, mtime or size is
+// reloaded, unless both have the same ELF build-id, known when the
+// module was checked through the manifest. Unchanged modules, and lazy
+// modules not loaded yet, are left alone. Modules whose dependencies
+// are not loaded yet are retried after the others. Each change is
+// reported to MicroModule.change_fn, and the files that fail to load
+// to MicroModule.skip_fn.
+// Returns MICRO_MODULE_OK once the directory was read, even if some
+// files failed, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_sync(MicroModule *mm,
+                  char* modules_dir,
+                  void* arg,
+                  MicroModuleSyncReport *report);
+
 // Unloads module identified by [module_name]
 // Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
 MICRO_MODULE_DEF int
@@ -244,9 +1233,53 @@ micro_module_exit(MicroModule *mm,
                   const char *module_name,
                   void* arg);
 
-// Unloads all loaded modules
+// Unloads all loaded modules. In concurrent mode, waits for the
+// readers as micro_module_synchronize before returning. The registry
+// nodes are then released in one go.
 // Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
 MICRO_MODULE_DEF int micro_module_exit_all(MicroModule *mm, void* arg);
+
+// Unloads all loaded modules using up to [nthreads] threads. If
+// [nthreads] is 0, one thread per online CPU is used.
+//
+// If MicroModule.deps_symbol is set, modules are exited in reverse
+// dependency order, and the modules that no remaining module depends
+// on are exited concurrently. Otherwise they are exited in reverse
+// load order, like micro_module_exit_all.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_exit_all_parallel(MicroModule *mm,
+                               void* arg,
+                               unsigned int nthreads);
+
+// Watches [modules_dir] for files being written, moved in, deleted or
+// moved out, and initializes [watch]. Bursts of changes are coalesced
+// until no new change happened for [debounce_ms] milliseconds. Then the
+// files written or moved in are loaded with micro_module_init,
+// replacing the module of the same name, and the modules whose file
+// went away are unloaded with micro_module_exit, both with [arg].
+//
+// Nothing runs in the background: poll MicroModuleWatch.fd for
+// readability, for example from an epoll loop, and call
+// micro_module_watch_dispatch when it is readable.
+// Returns MICRO_MODULE_OK on success, or a negative MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int
+micro_module_watch(MicroModule *mm,
+                   MicroModuleWatch *watch,
+                   const char *modules_dir,
+                   void* arg,
+                   unsigned int debounce_ms);
+
+// Reads the pending events of [watch] without blocking, and applies
+// the changes once the debounce window expired. Files that fail to
+// load are reported to MicroModule.skip_fn. If the kernel dropped
+// events, the whole directory is synchronized with micro_module_sync.
+// Returns the number of files applied, or a negative
+// MICRO_MODULE_ERROR_
+MICRO_MODULE_DEF int micro_module_watch_dispatch(MicroModuleWatch *watch);
+
+// Stops watching, dropping the changes not applied yet
+MICRO_MODULE_DEF void micro_module_watch_close(MicroModuleWatch *watch);
   
 //
 // Implementation
@@ -257,156 +1290,4031 @@ MICRO_MODULE_DEF int micro_module_exit_all(MicroModule *mm, void* arg);
 #include <fts.h>
 #include <dlfcn.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <link.h>
+#include <gnu/lib-names.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
 
-MICRO_MODULE_DEF MicroModule
-micro_module_setup(const char* name_symbol,
-                   const char* init_fn_symbol,
-                   const char* exit_fn_symbol,
-                   bool use_new_namespace)
+// Marks a slot of the index whose module was removed
+#define _MICRO_MODULE_TOMBSTONE ((MicroModuleList*)(uintptr_t)1)
+
+static void *_micro_module_alloc(MicroModule *mm, size_t size)
 {
-  return (MicroModule) {
-    .name_symbol       = name_symbol,
-    .init_fn_symbol    = init_fn_symbol,
-    .exit_fn_symbol    = exit_fn_symbol,
-    .use_new_namespace = use_new_namespace,
-    .modules           = NULL,
-  };
+  if (mm->allocator.alloc)
+    return mm->allocator.alloc(mm->allocator.ctx, size);
+  return MICRO_MODULE_MALLOC(size);
 }
 
-MICRO_MODULE_DEF int
-micro_module_init(MicroModule *mm, char* filename, void* arg)
+static void _micro_module_free(MicroModule *mm, void *ptr)
 {
-  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
-
-  MicroModuleEntry module;
+  if (mm->allocator.free)
+    mm->allocator.free(mm->allocator.ctx, ptr);
+  else
+    MICRO_MODULE_FREE(ptr);
+}
 
-  if (mm->use_new_namespace)
+// Takes a node out of the slabs of [mm], adding a slab if they are
+// full. Returns NULL if memory ran out.
+static MicroModuleList *_micro_module_node_new(MicroModule *mm)
+{
+  pthread_mutex_lock(&mm->lock);
+  if (!mm->free_nodes)
   {
-    module.dlhandler = dlmopen(LM_ID_NEWLM, filename, RTLD_LAZY | RTLD_LOCAL);
+    size_t capacity = mm->slabs ? mm->slabs->capacity * 2
+                                : MICRO_MODULE_SLAB_CAPACITY;
+    MicroModuleSlab *slab =
+      _micro_module_alloc(mm, sizeof(MicroModuleSlab)
+                              + capacity * sizeof(MicroModuleList));
+    if (!slab)
+    {
+      pthread_mutex_unlock(&mm->lock);
+      return NULL;
+    }
+    slab->capacity = capacity;
+    slab->next = mm->slabs;
+    mm->slabs = slab;
+    // Hand the nodes out in address order
+    for (size_t i = capacity; i-- > 0;)
+    {
+      pthread_cond_init(&slab->nodes[i].loaded, NULL);
+      slab->nodes[i].next = mm->free_nodes;
+      mm->free_nodes = &slab->nodes[i];
+    }
   }
-  else
+  MicroModuleList *node = mm->free_nodes;
+  mm->free_nodes = node->next;
+  mm->nodes_used++;
+  pthread_mutex_unlock(&mm->lock);
+  return node;
+}
+
+// Gives [node] back to the slabs of [mm]
+static void _micro_module_node_release(MicroModule *mm, MicroModuleList *node)
+{
+  pthread_mutex_lock(&mm->lock);
+  node->next = mm->free_nodes;
+  mm->free_nodes = node;
+  mm->nodes_used--;
+  pthread_mutex_unlock(&mm->lock);
+}
+
+// Waits until the lazy module of [node] is no longer being loaded on
+// first use by another thread. Must be called with MicroModule.lock
+// held once, which is released meanwhile.
+static void _micro_module_wait_loading(MicroModule *mm, MicroModuleList *node)
+{
+  while (node->module.state == MICRO_MODULE_STATE_LOADING
+         && !pthread_equal(node->loader, pthread_self()))
+    pthread_cond_wait(&node->loaded, &mm->lock);
+}
+
+// Frees what the readers of [mm] can no longer see. Must be called
+// with MicroModule.lock held.
+static void _micro_module_reclaim(MicroModule *mm)
+{
+  // Pairs with the fence of micro_module_read_lock: either the reader
+  // is seen here, or it will not see what was unlinked before
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  uint64_t oldest = UINT64_MAX;
+  for (size_t i = 0; i < MICRO_MODULE_MAX_READERS; ++i)
   {
-    module.dlhandler = dlmopen(LM_ID_BASE, filename, RTLD_LAZY | RTLD_LOCAL);
+    uint64_t epoch = __atomic_load_n(&mm->readers[i].epoch, __ATOMIC_ACQUIRE);
+    if (epoch != 0 && epoch < oldest)
+      oldest = epoch;
   }
-  
-  if (!module.dlhandler) return MICRO_MODULE_ERROR_OPENING_MODULE;
 
-  *(void**)(&module.init_fn) = dlsym(module.dlhandler, mm->init_fn_symbol);
-  if (!module.init_fn)
+  MicroModuleRetired **it = &mm->retired;
+  while (*it)
   {
-    dlclose(module.dlhandler);
-    return MICRO_MODULE_ERROR_LOCATING_INIT_SYMBOL;
+    MicroModuleRetired *retired = *it;
+    if (retired->epoch < oldest)
+    {
+      *it = retired->next;
+      retired->free_fn(mm, retired);
+    }
+    else
+    {
+      it = &retired->next;
+    }
   }
-  
-  *(void**)(&module.exit_fn) = dlsym(module.dlhandler, mm->exit_fn_symbol);
-  if (!module.exit_fn)
+}
+
+// Frees [retired] once no reader of [mm] can see it, right away if
+// [mm] is not concurrent. It must have been unlinked already, and
+// MicroModule.lock must be held.
+static void _micro_module_retire(MicroModule *mm,
+                                 MicroModuleRetired *retired,
+                                 void (*free_fn)(MicroModule*,
+                                                 MicroModuleRetired*))
+{
+  retired->free_fn = free_fn;
+  if (!mm->concurrent)
   {
-    dlclose(module.dlhandler);
-    return MICRO_MODULE_ERROR_LOCATING_EXIT_SYMBOL;
+    free_fn(mm, retired);
+    return;
   }
+  // Readers starting from now on get a later epoch
+  retired->epoch = __atomic_fetch_add(&mm->epoch, 1, __ATOMIC_SEQ_CST);
+  retired->next  = mm->retired;
+  mm->retired    = retired;
+  _micro_module_reclaim(mm);
+}
 
-  module.name = dlsym(module.dlhandler, mm->name_symbol);
-  if (!module.name)
+// FNV-1a hash of [name], also returns its length in [length]
+static uint32_t _micro_module_hash(const char *name, size_t *length)
+{
+  uint32_t hash = 2166136261u;
+  const char *it = name;
+  while (*it)
   {
-    dlclose(module.dlhandler);
-    return MICRO_MODULE_ERROR_LOCATING_NAME_SYMBOL;
+    hash ^= (unsigned char)*it++;
+    hash *= 16777619u;
   }
+  *length = (size_t)(it - name);
+  return hash;
+}
 
-  // Check if module was already registered
-  bool found = false;
-  MicroModuleList *it = mm->modules;
-  while (it)
-  {
-    if (strcmp(it->module.name, module.name) == 0)
-    {
-      found = true;
+// Whether [slot], whose node is [node], holds [name]
+static bool _micro_module_slot_matches(const MicroModuleIndexSlot *slot,
+                                       const MicroModuleList *node,
+                                       const char *name,
+                                       uint32_t hash,
+                                       size_t length)
+{
+  if (node == NULL || node == _MICRO_MODULE_TOMBSTONE)
+    return false;
+  if (slot->hash != hash || slot->length != length)
+    return false;
+  if (length < MICRO_MODULE_NAME_INLINE)
+    return memcmp(slot->name, name, length) == 0;
+  // Name does not fit inline, compare the prefix first
+  if (memcmp(slot->name, name, MICRO_MODULE_NAME_INLINE - 1) != 0)
+    return false;
+  return strcmp(node->module.name, name) == 0;
+}
 
-      // Exit the loaded module
-      it->module.exit_fn(arg);
-      if (dlclose(it->module.dlhandler) != 0)
-      {
-        dlclose(module.dlhandler);
-        return MICRO_MODULE_ERROR_CLOSING_MODULE;
-      }
+static MicroModuleIndex* _micro_module_index_new(MicroModule *mm,
+                                                 size_t capacity)
+{
+  MicroModuleIndex *index =
+    _micro_module_alloc(mm, sizeof(MicroModuleIndex)
+                            + capacity * sizeof(MicroModuleIndexSlot));
+  if (!index) return NULL;
+  index->capacity = capacity;
+  index->count    = 0;
+  index->used     = 0;
+  index->slots    = (MicroModuleIndexSlot*)(index + 1);
+  memset(index->slots, 0, capacity * sizeof(MicroModuleIndexSlot));
+  return index;
+}
 
-      it->module = module;
-      break;
-    }
-    it = it->next;
-  }
+// Returns the slot of [name], or NULL if it is not in the index
+//
+// Slots are filled before their node is published, and never reused
+// for another name until the index is rehashed into a new one, so
+// this is safe against a concurrent writer.
+static MicroModuleIndexSlot*
+_micro_module_index_find(MicroModuleIndex *index,
+                         const char *name,
+                         uint32_t hash,
+                         size_t length)
+{
+  if (!index) return NULL;
 
-  if (!found)
+  size_t mask = index->capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask)
   {
-    // Add to the module list
-    MicroModuleList *new_module = MICRO_MODULE_MALLOC(sizeof(MicroModuleList));
-    if (!new_module) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
-    new_module->module = module;
-    if (!mm->modules)
-    {  
-      new_module->next = NULL;
-      mm->modules = new_module;
-    }
-    else
-    {
-      new_module->next = mm->modules;
-      mm->modules = new_module;
-    }
+    MicroModuleIndexSlot *slot = &index->slots[i];
+    MicroModuleList *node = __atomic_load_n(&slot->node, __ATOMIC_ACQUIRE);
+    if (node == NULL) return NULL;
+    if (_micro_module_slot_matches(slot, node, name, hash, length)) return slot;
   }
-  
-  // Call the function
-  int err = 0;
-  err = module.init_fn(arg);
-  if (err != 0) return err;
+}
 
-  return MICRO_MODULE_OK;
+// Returns the first never used slot for [hash]
+static MicroModuleIndexSlot*
+_micro_module_index_free_slot(MicroModuleIndex *index, uint32_t hash)
+{
+  size_t mask = index->capacity - 1;
+  size_t i = hash & mask;
+  while (index->slots[i].node != NULL)
+    i = (i + 1) & mask;
+  return &index->slots[i];
 }
 
-MICRO_MODULE_DEF int
-micro_module_init_all(MicroModule *mm, char *modules_dir, void* arg)
+static void _micro_module_index_free(MicroModule *mm,
+                                     MicroModuleRetired *retired)
 {
-  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  _micro_module_free(mm, (char*)retired - offsetof(MicroModuleIndex, retired));
+}
 
-  int err = MICRO_MODULE_OK;
-  char *path_argv[] = { modules_dir, NULL };
-  FTSENT *file_entry = NULL;
+// Makes room for one more module, growing the index or clearing its
+// tombstones when the load factor would exceed 3/4
+static int _micro_module_index_reserve(MicroModule *mm)
+{
+  MicroModuleIndex *old = mm->index;
+  if (!old)
+  {
+    MicroModuleIndex *index = _micro_module_index_new(mm, MICRO_MODULE_INDEX_CAPACITY);
+    if (!index) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    __atomic_store_n(&mm->index, index, __ATOMIC_RELEASE);
+    return MICRO_MODULE_OK;
+  }
+  if ((old->used + 1) * 4 <= old->capacity * 3)
+    return MICRO_MODULE_OK;
+
+  size_t capacity = old->capacity;
+  while ((old->count + 1) * 2 > capacity)
+    capacity *= 2;
+
+  MicroModuleIndex *index = _micro_module_index_new(mm, capacity);
+  if (!index) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+
+  for (size_t i = 0; i < old->capacity; ++i)
+  {
+    MicroModuleIndexSlot *slot = &old->slots[i];
+    if (slot->node == NULL || slot->node == _MICRO_MODULE_TOMBSTONE)
+      continue;
+    *_micro_module_index_free_slot(index, slot->hash) = *slot;
+  }
+  index->count = old->count;
+  index->used  = old->count;
+
+  __atomic_store_n(&mm->index, index, __ATOMIC_RELEASE);
+  _micro_module_retire(mm, &old->retired, _micro_module_index_free);
+  return MICRO_MODULE_OK;
+}
+
+// Adds [node] to the index, the name must not be already present
+// The index must have been reserved before
+static void _micro_module_index_insert(MicroModuleIndex *index,
+                                       MicroModuleList *node,
+                                       uint32_t hash,
+                                       size_t length)
+{
+  MicroModuleIndexSlot *slot = _micro_module_index_free_slot(index, hash);
+  size_t inline_length = length < MICRO_MODULE_NAME_INLINE
+    ? length : MICRO_MODULE_NAME_INLINE - 1;
+  slot->hash   = hash;
+  slot->length = (uint32_t)length;
+  memcpy(slot->name, node->module.name, inline_length);
+  slot->name[inline_length] = '\0';
+  __atomic_store_n(&slot->node, node, __ATOMIC_RELEASE);
+  index->count++;
+  index->used++;
+}
+
+static void _micro_module_index_remove(MicroModuleIndex *index,
+                                       MicroModuleIndexSlot *slot)
+{
+  __atomic_store_n(&slot->node, _MICRO_MODULE_TOMBSTONE, __ATOMIC_RELEASE);
+  index->count--;
+}
+
+#ifdef MICRO_MODULE_STATS
+
+static uint64_t _micro_module_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void _micro_module_phase_add(MicroModulePhaseStats *phase,
+                                    uint64_t ns)
+{
+  if (phase->count == 0 || ns < phase->min_ns) phase->min_ns = ns;
+  if (ns > phase->max_ns) phase->max_ns = ns;
+  phase->last_ns   = ns;
+  phase->total_ns += ns;
+  phase->count++;
+}
+
+// Adds [src] to [dst], [src] being the most recent
+static void _micro_module_stats_merge(MicroModuleStats *dst,
+                                      const MicroModuleStats *src)
+{
+  for (size_t i = 0; i < MICRO_MODULE_PHASE_COUNT; ++i)
+  {
+    MicroModulePhaseStats *d = &dst->phases[i];
+    const MicroModulePhaseStats *s = &src->phases[i];
+    if (s->count == 0) continue;
+    if (d->count == 0 || s->min_ns < d->min_ns) d->min_ns = s->min_ns;
+    if (s->max_ns > d->max_ns) d->max_ns = s->max_ns;
+    d->last_ns   = s->last_ns;
+    d->total_ns += s->total_ns;
+    d->count    += s->count;
+  }
+  dst->loads   += src->loads;
+  dst->reloads += src->reloads;
+  dst->unloads += src->unloads;
+}
+
+// Returns the statistics of the registered module called [name], or
+// NULL if there is none
+static MicroModuleStats *_micro_module_stats_find(MicroModule *mm,
+                                                  const char *name)
+{
+  size_t length;
+  uint32_t hash = _micro_module_hash(name, &length);
+  MicroModuleIndex *index = __atomic_load_n(&mm->index, __ATOMIC_ACQUIRE);
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(index, name, hash, length);
+  return slot ? &slot->node->module.stats : NULL;
+}
+
+// Records that [phase] ran from [since] until now, in the totals of
+// [mm] and in the optional statistics of a module [stats]
+static void _micro_module_stats_record(MicroModule *mm,
+                                       MicroModuleStats *stats,
+                                       int phase,
+                                       uint64_t since)
+{
+  uint64_t ns = _micro_module_now() - since;
+  pthread_mutex_lock(&mm->stats_lock);
+  _micro_module_phase_add(&mm->stats.phases[phase], ns);
+  if (stats)
+    _micro_module_phase_add(&stats->phases[phase], ns);
+  pthread_mutex_unlock(&mm->stats_lock);
+}
+
+// Adds one to the counter at [offset] of the totals of [mm] and of
+// the optional [stats]
+static void _micro_module_stats_count(MicroModule *mm,
+                                      MicroModuleStats *stats,
+                                      size_t offset)
+{
+  pthread_mutex_lock(&mm->stats_lock);
+  (*(uint64_t*)((char*)&mm->stats + offset))++;
+  if (stats)
+    (*(uint64_t*)((char*)stats + offset))++;
+  pthread_mutex_unlock(&mm->stats_lock);
+}
+
+// Carries the statistics of [old] over to [module], which replaces it
+static void _micro_module_stats_reload(MicroModule *mm,
+                                       MicroModuleEntry *module,
+                                       MicroModuleEntry *old)
+{
+  pthread_mutex_lock(&mm->stats_lock);
+  MicroModuleStats stats = old->stats;
+  _micro_module_stats_merge(&stats, &module->stats);
+  stats.reloads++;
+  module->stats = stats;
+  mm->stats.reloads++;
+  pthread_mutex_unlock(&mm->stats_lock);
+}
+
+  #define _MICRO_MODULE_CLOCK(since) uint64_t since = _micro_module_now()
+  #define _MICRO_MODULE_RECORD(mm, stats, phase, since) \
+    _micro_module_stats_record(mm, stats, phase, since)
+  #define _MICRO_MODULE_COUNT(mm, stats, counter) \
+    _micro_module_stats_count(mm, stats, offsetof(MicroModuleStats, counter))
+  #define _MICRO_MODULE_RELOAD(mm, module, old) \
+    _micro_module_stats_reload(mm, module, old)
+#else
+  #define _MICRO_MODULE_CLOCK(since) (void)0
+  #define _MICRO_MODULE_RECORD(mm, stats, phase, since) (void)0
+  #define _MICRO_MODULE_COUNT(mm, stats, counter) (void)0
+  #define _MICRO_MODULE_RELOAD(mm, module, old) (void)0
+#endif // MICRO_MODULE_STATS
+
+// Fills [id] from [st], leaving its build-id as it is
+static void _micro_module_file_id_from_stat(const struct stat *st,
+                                            MicroModuleFileId *id)
+{
+  id->dev        = st->st_dev;
+  id->ino        = st->st_ino;
+  id->mtime_sec  = st->st_mtim.tv_sec;
+  id->mtime_nsec = st->st_mtim.tv_nsec;
+  id->size       = (uint64_t)st->st_size;
+}
+
+// Reads the identity of [path], without its build-id
+static bool _micro_module_file_id(const char *path, MicroModuleFileId *id)
+{
+  struct statx stx;
+  if (statx(AT_FDCWD, path, 0, STATX_INO | STATX_MTIME | STATX_SIZE, &stx) != 0)
+    return false;
+  memset(id, 0, sizeof(*id));
+  id->dev        = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  id->ino        = stx.stx_ino;
+  id->mtime_sec  = stx.stx_mtime.tv_sec;
+  id->mtime_nsec = stx.stx_mtime.tv_nsec;
+  id->size       = stx.stx_size;
+  return true;
+}
+
+// Compares the identities, without their build-ids
+static bool _micro_module_file_id_equal(const MicroModuleFileId *a,
+                                        const MicroModuleFileId *b)
+{
+  return a->dev == b->dev && a->ino == b->ino
+    && a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec
+    && a->size == b->size;
+}
+
+// Returns the namespace of [mm] that [dlhandler] was opened in, or
+// NULL if it was not opened in one
+static MicroModuleNamespace *_micro_module_namespace_of(MicroModule *mm,
+                                                        void *dlhandler)
+{
+  Lmid_t lmid;
+  if (mm->namespaces_count == 0
+      || dlinfo(dlhandler, RTLD_DI_LMID, &lmid) != 0)
+    return NULL;
+  for (size_t i = 0; i < mm->namespaces_count; ++i)
+    if (mm->namespaces[i].lmid == (long)lmid)
+      return &mm->namespaces[i];
+  return NULL;
+}
+
+// Whether [ns] belongs to the isolation group [group]
+static bool _micro_module_namespace_in(const MicroModuleNamespace *ns,
+                                       const char *group)
+{
+  if (!ns->group || !group) return ns->group == group;
+  return strcmp(ns->group, group) == 0;
+}
+
+// Picks the namespace for [filename] according to its isolation group
+// or MicroModule.namespace_policy, creating it if needed, and counts
+// the module in it. Returns NULL and sets [err] if there is none left.
+static MicroModuleNamespace *_micro_module_namespace_take(MicroModule *mm,
+                                                          const char *filename,
+                                                          int *err)
+{
+  const char *group = mm->group_fn
+    ? mm->group_fn(filename, mm->group_arg) : NULL;
+  pthread_mutex_lock(&mm->lock);
+
+  // glibc hands back the loaded copy of a file opened again in the
+  // same namespace, matching it by path before its inode, so a reload
+  // has to go to another one, even if the file was replaced meanwhile
+  bool excluded[MICRO_MODULE_MAX_NAMESPACES] = { false };
+  struct stat st;
+  bool has_stat = stat(filename, &st) == 0;
+  for (MicroModuleList *it = mm->namespaces_count > 0 ? mm->modules : NULL;
+       it; it = it->next)
+  {
+    if (!it->module.dlhandler) continue;
+    bool same_file = has_stat && it->module.file_id.dev == st.st_dev
+      && it->module.file_id.ino == st.st_ino;
+    bool same_path = it->module.path && strcmp(it->module.path, filename) == 0;
+    if (!same_file && !same_path) continue;
+    MicroModuleNamespace *loaded =
+      _micro_module_namespace_of(mm, it->module.dlhandler);
+    if (loaded)
+      excluded[loaded - mm->namespaces] = true;
+  }
+
+  // A group shares a namespace, the others follow the policy
+  bool shared = group || mm->namespace_policy == MICRO_MODULE_NAMESPACE_SHARED;
+  MicroModuleNamespace *ns = NULL;
+  MicroModuleNamespace *empty = NULL;
+  for (size_t i = 0; i < mm->namespaces_count; ++i)
+  {
+    MicroModuleNamespace *it = &mm->namespaces[i];
+    if (excluded[i]) continue;
+    if (!_micro_module_namespace_in(it, group))
+    {
+      // Emptied namespaces can change group
+      if (it->modules == 0 && !empty)
+        empty = it;
+      continue;
+    }
+    if (shared)
+    {
+      ns = it;
+      break;
+    }
+    if (!ns || it->modules < ns->modules)
+      ns = it;
+  }
+  bool room = mm->namespaces_count < MICRO_MODULE_MAX_NAMESPACES;
+  if (ns && ns->modules > 0 && !shared
+      && (room || empty
+          || mm->namespace_policy == MICRO_MODULE_NAMESPACE_EXCLUSIVE))
+    ns = NULL;
+
+  if (!ns && (empty || room))
+  {
+    char *label = NULL;
+    if (group)
+    {
+      size_t length = strlen(group) + 1;
+      label = _micro_module_alloc(mm, length);
+      if (!label)
+      {
+        *err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+        pthread_mutex_unlock(&mm->lock);
+        return NULL;
+      }
+      memcpy(label, group, length);
+    }
+
+    if (empty)
+    {
+      ns = empty;
+      _micro_module_free(mm, ns->group);
+      ns->group = label;
+    }
+    else
+    {
+      // A namespace only lives as long as something is loaded in it
+      Lmid_t lmid;
+      void *anchor = dlmopen(LM_ID_NEWLM, LIBC_SO, RTLD_LAZY | RTLD_LOCAL);
+      if (anchor && dlinfo(anchor, RTLD_DI_LMID, &lmid) == 0)
+      {
+        ns = &mm->namespaces[mm->namespaces_count++];
+        ns->lmid    = (long)lmid;
+        ns->anchor  = anchor;
+        ns->modules = 0;
+        ns->group   = label;
+      }
+      else
+      {
+        if (anchor) dlclose(anchor);
+        _micro_module_free(mm, label);
+      }
+    }
+  }
+
+  if (ns)
+    ns->modules++;
+  else
+    *err = MICRO_MODULE_ERROR_NO_NAMESPACE;
+  pthread_mutex_unlock(&mm->lock);
+  return ns;
+}
+
+// dlmopens [filename] in the namespace configured in [mm]
+// Returns NULL and sets [err] on failure
+static void *_micro_module_dlmopen(MicroModule *mm,
+                                   const char *filename,
+                                   int *err)
+{
+  *err = MICRO_MODULE_ERROR_OPENING_MODULE;
+  if (!mm->use_new_namespace)
+    return dlmopen(LM_ID_BASE, filename, RTLD_LAZY | RTLD_LOCAL);
+
+  MicroModuleNamespace *ns = _micro_module_namespace_take(mm, filename, err);
+  if (!ns) return NULL;
+  void *dlhandler = dlmopen((Lmid_t)ns->lmid, filename, RTLD_LAZY | RTLD_LOCAL);
+  if (!dlhandler)
+  {
+    pthread_mutex_lock(&mm->lock);
+    ns->modules--;
+    pthread_mutex_unlock(&mm->lock);
+    *err = MICRO_MODULE_ERROR_OPENING_MODULE;
+  }
+  return dlhandler;
+}
+
+// dlcloses a module opened by _micro_module_dlmopen
+static int _micro_module_dlclose(MicroModule *mm, void *dlhandler)
+{
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleNamespace *ns = _micro_module_namespace_of(mm, dlhandler);
+  pthread_mutex_unlock(&mm->lock);
+  if (dlclose(dlhandler) != 0) return -1;
+  if (ns)
+  {
+    pthread_mutex_lock(&mm->lock);
+    ns->modules--;
+    pthread_mutex_unlock(&mm->lock);
+  }
+  return 0;
+}
+
+// Copies [filename] into the path of [module]
+static int _micro_module_set_path(MicroModule *mm,
+                                  MicroModuleEntry *module,
+                                  const char *filename)
+{
+  size_t path_length = strlen(filename) + 1;
+  module->path = _micro_module_alloc(mm, path_length);
+  if (!module->path) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  memcpy(module->path, filename, path_length);
+  return MICRO_MODULE_OK;
+}
+
+// Frees [cache] and the caches it replaced
+static void _micro_module_sym_cache_free(MicroModule *mm,
+                                         MicroModuleSymCache *cache)
+{
+  if (!cache) return;
+  // The names are shared with the retired caches
+  for (size_t i = 0; i < cache->capacity; ++i)
+    _micro_module_free(mm, cache->slots[i].symbol);
+  while (cache)
+  {
+    MicroModuleSymCache *retired = cache->retired;
+    _micro_module_free(mm, cache);
+    cache = retired;
+  }
+}
+
+static MicroModuleRefs *_micro_module_refs_new(MicroModule *mm)
+{
+  MicroModuleRefs *refs = _micro_module_alloc(mm, sizeof(MicroModuleRefs));
+  if (!refs) return NULL;
+  memset(refs, 0, sizeof(*refs));
+  refs->mm = mm;
+  return refs;
+}
+
+// Whether no call is in flight in the module of [refs]
+static bool _micro_module_refs_idle(MicroModuleRefs *refs)
+{
+  for (size_t i = 0; i < MICRO_MODULE_REF_SHARDS; ++i)
+    if (__atomic_load_n(&refs->shards[i].count, __ATOMIC_SEQ_CST) != 0)
+      return false;
+  return true;
+}
+
+// Refuses new calls into [module], then waits up to
+// MicroModule.drain_timeout_ms for the calls in flight to end
+static void _micro_module_drain(MicroModuleEntry *module)
+{
+  MicroModuleRefs *refs = module->refs;
+  if (!refs) return;
+  // Pairs with micro_module_enter: either the call is counted here, or
+  // it sees the flag and backs off
+  __atomic_store_n(&refs->closing, true, __ATOMIC_SEQ_CST);
+
+  struct timespec now, deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec  += refs->mm->drain_timeout_ms / 1000;
+  deadline.tv_nsec += (long)(refs->mm->drain_timeout_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  for (;;)
+  {
+    if (_micro_module_refs_idle(refs)) return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline.tv_sec
+        || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+      return;
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+    nanosleep(&pause, NULL);
+  }
+}
+
+// Closes [module] if it was opened and frees what it owns
+// On failure the module is left untouched
+//
+// If calls are still in flight in it, what it owns is handed to its
+// MicroModuleRefs instead, to be released by micro_module_reap.
+static int _micro_module_close(MicroModule *mm, MicroModuleEntry *module)
+{
+  MicroModuleRefs *refs = module->refs;
+  if (refs)
+  {
+    __atomic_store_n(&refs->closing, true, __ATOMIC_SEQ_CST);
+    if (!_micro_module_refs_idle(refs))
+    {
+      refs->dlhandler = module->dlhandler;
+      refs->path      = module->path;
+      refs->memfd     = module->memfd;
+      refs->fns       = module->fns;
+      refs->syms      = module->syms;
+      pthread_mutex_lock(&refs->mm->lock);
+      refs->next = refs->mm->draining;
+      refs->mm->draining = refs;
+      pthread_mutex_unlock(&refs->mm->lock);
+      module->dlhandler = NULL;
+      module->path      = NULL;
+      module->memfd     = 0;
+      module->syms      = NULL;
+      module->fns       = NULL;
+      module->refs      = NULL;
+      return MICRO_MODULE_OK;
+    }
+  }
+
+  if (module->dlhandler)
+  {
+    _MICRO_MODULE_CLOCK(close_start);
+    if (_micro_module_dlclose(mm, module->dlhandler) != 0)
+      return MICRO_MODULE_ERROR_CLOSING_MODULE;
+    _MICRO_MODULE_RECORD(mm, NULL, MICRO_MODULE_PHASE_CLOSE, close_start);
+  }
+  if (module->memfd > 0)
+    close(module->memfd);
+  _micro_module_free(mm, module->path);
+  _micro_module_free(mm, module->fns);
+  _micro_module_free(mm, refs);
+  _micro_module_sym_cache_free(mm, module->syms);
+  module->dlhandler = NULL;
+  module->path      = NULL;
+  module->memfd     = 0;
+  module->syms      = NULL;
+  module->fns       = NULL;
+  module->refs      = NULL;
+  return MICRO_MODULE_OK;
+}
+
+// Closes the module of an unlinked node and frees it
+static void _micro_module_node_free(MicroModule *mm,
+                                    MicroModuleRetired *retired)
+{
+  MicroModuleList *node = (MicroModuleList*)
+    ((char*)retired - offsetof(MicroModuleList, retired));
+  _micro_module_close(mm, &node->module);
+  _micro_module_node_release(mm, node);
+}
+
+// Resolves MicroModule.symbols into the fns of the open [module], and
+// sets up the counting of its calls
+static int _micro_module_resolve_symbols(MicroModule *mm,
+                                         MicroModuleEntry *module)
+{
+  module->refs = _micro_module_refs_new(mm);
+  if (!module->refs) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  if (!mm->symbols || mm->symbols_count == 0) return MICRO_MODULE_OK;
+
+  module->fns = _micro_module_alloc(mm, mm->symbols_count * sizeof(void*));
+  if (!module->fns) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  for (size_t i = 0; i < mm->symbols_count; ++i)
+  {
+    module->fns[i] = dlsym(module->dlhandler, mm->symbols[i].name);
+    if (!module->fns[i] && mm->symbols[i].required)
+      return MICRO_MODULE_ERROR_LOCATING_SYMBOL;
+  }
+  return MICRO_MODULE_OK;
+}
+
+// Opens the module in [filename] and resolves its symbols into [module]
+static int _micro_module_open(MicroModule *mm,
+                              const char *filename,
+                              MicroModuleEntry *module)
+{
+  memset(module, 0, sizeof(*module));
+  _micro_module_file_id(filename, &module->file_id);
+  _MICRO_MODULE_CLOCK(open_start);
+  int err;
+  module->dlhandler = _micro_module_dlmopen(mm, filename, &err);
+  _MICRO_MODULE_RECORD(mm, &module->stats, MICRO_MODULE_PHASE_OPEN, open_start);
+  if (!module->dlhandler) return err;
+
+  _MICRO_MODULE_CLOCK(symbols_start);
+
+  *(void**)(&module->init_fn) = dlsym(module->dlhandler, mm->init_fn_symbol);
+  if (!module->init_fn)
+  {
+    _micro_module_dlclose(mm, module->dlhandler);
+    return MICRO_MODULE_ERROR_LOCATING_INIT_SYMBOL;
+  }
+  
+  *(void**)(&module->exit_fn) = dlsym(module->dlhandler, mm->exit_fn_symbol);
+  if (!module->exit_fn)
+  {
+    _micro_module_dlclose(mm, module->dlhandler);
+    return MICRO_MODULE_ERROR_LOCATING_EXIT_SYMBOL;
+  }
+
+  module->name = dlsym(module->dlhandler, mm->name_symbol);
+  if (!module->name)
+  {
+    _micro_module_dlclose(mm, module->dlhandler);
+    return MICRO_MODULE_ERROR_LOCATING_NAME_SYMBOL;
+  }
+
+  if (mm->independent_symbol)
+    module->independent = dlsym(module->dlhandler, mm->independent_symbol) != NULL;
+  if (mm->deps_symbol)
+    module->deps = dlsym(module->dlhandler, mm->deps_symbol);
+
+  if (_micro_module_set_path(mm, module, filename) != MICRO_MODULE_OK)
+  {
+    _micro_module_dlclose(mm, module->dlhandler);
+    return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  }
+
+  err = _micro_module_resolve_symbols(mm, module);
+  if (err != MICRO_MODULE_OK)
+  {
+    _micro_module_close(mm, module);
+    return err;
+  }
+  _MICRO_MODULE_RECORD(mm, &module->stats, MICRO_MODULE_PHASE_SYMBOLS,
+                       symbols_start);
+
+  return MICRO_MODULE_OK;
+}
+
+static bool _micro_module_is_loaded(MicroModuleEntry *module)
+{
+  return __atomic_load_n(&module->state, __ATOMIC_ACQUIRE)
+    == MICRO_MODULE_STATE_LOADED;
+}
+
+#if defined(__x86_64__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_X86_64
+#elif defined(__aarch64__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_AARCH64
+#elif defined(__i386__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_386
+#elif defined(__arm__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_ARM
+#elif defined(__riscv)
+  #define _MICRO_MODULE_ELF_MACHINE EM_RISCV
+#elif defined(__powerpc64__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_PPC64
+#elif defined(__powerpc__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_PPC
+#elif defined(__s390__)
+  #define _MICRO_MODULE_ELF_MACHINE EM_S390
+#else
+  // Unknown machine, not checked
+  #define _MICRO_MODULE_ELF_MACHINE EM_NONE
+#endif
+
+#if __SIZEOF_POINTER__ == 8
+  #define _MICRO_MODULE_ELF_CLASS ELFCLASS64
+#else
+  #define _MICRO_MODULE_ELF_CLASS ELFCLASS32
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  #define _MICRO_MODULE_ELF_DATA ELFDATA2LSB
+#else
+  #define _MICRO_MODULE_ELF_DATA ELFDATA2MSB
+#endif
+
+// What was learned about a module file from its ELF headers
+typedef struct {
+  MicroModuleFileId file_id;
+  // The module name, empty if it did not fit
+  char name[256];
+  // Offsets of the symbols from the load address, 0 if not defined
+  uint64_t name_offset;
+  uint64_t init_offset;
+  uint64_t exit_offset;
+  uint64_t independent_offset;
+  uint64_t deps_offset;
+} _MicroModuleElfInfo;
+
+// A mapped ELF file, as seen through its dynamic section
+typedef struct {
+  const unsigned char *map;
+  size_t size;
+  const ElfW(Phdr) *phdrs;
+  size_t phnum;
+  const ElfW(Sym) *symtab;
+  size_t symtab_offset;
+  const char *strtab;
+  size_t strtab_size;
+  const uint32_t *gnu_hash;
+  size_t gnu_hash_offset;
+  const uint32_t *sysv_hash;
+  size_t sysv_hash_offset;
+} _MicroModuleElf;
+
+// Returns the [length] bytes at [offset] of the file, or NULL if they
+// are out of its bounds
+static const void *_micro_module_elf_at(const _MicroModuleElf *elf,
+                                        size_t offset,
+                                        size_t length)
+{
+  if (offset > elf->size || length > elf->size - offset) return NULL;
+  return elf->map + offset;
+}
+
+// Translates the virtual address [addr] to a file offset
+static bool _micro_module_elf_offset(const _MicroModuleElf *elf,
+                                     ElfW(Addr) addr,
+                                     size_t *offset)
+{
+  for (size_t i = 0; i < elf->phnum; ++i)
+  {
+    const ElfW(Phdr) *phdr = &elf->phdrs[i];
+    if (phdr->p_type == PT_LOAD
+        && addr >= phdr->p_vaddr
+        && addr - phdr->p_vaddr < phdr->p_filesz)
+    {
+      *offset = phdr->p_offset + (addr - phdr->p_vaddr);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads the headers and the dynamic section of the mapped file
+static int _micro_module_elf_parse(_MicroModuleElf *elf)
+{
+  const ElfW(Ehdr) *ehdr = _micro_module_elf_at(elf, 0, sizeof(ElfW(Ehdr)));
+  if (!ehdr
+      || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+      || ehdr->e_ident[EI_CLASS] != _MICRO_MODULE_ELF_CLASS
+      || ehdr->e_ident[EI_DATA] != _MICRO_MODULE_ELF_DATA
+      || ehdr->e_type != ET_DYN
+      || ehdr->e_phentsize != sizeof(ElfW(Phdr)))
+    return MICRO_MODULE_ERROR_NOT_A_MODULE;
+  if (_MICRO_MODULE_ELF_MACHINE != EM_NONE
+      && ehdr->e_machine != _MICRO_MODULE_ELF_MACHINE)
+    return MICRO_MODULE_ERROR_NOT_A_MODULE;
+
+  elf->phnum = ehdr->e_phnum;
+  elf->phdrs = _micro_module_elf_at(elf, ehdr->e_phoff,
+                                    elf->phnum * sizeof(ElfW(Phdr)));
+  if (!elf->phdrs) return MICRO_MODULE_ERROR_NOT_A_MODULE;
+
+  const ElfW(Dyn) *dyn = NULL;
+  size_t dyn_count = 0;
+  for (size_t i = 0; i < elf->phnum; ++i)
+  {
+    if (elf->phdrs[i].p_type != PT_DYNAMIC) continue;
+    dyn_count = elf->phdrs[i].p_filesz / sizeof(ElfW(Dyn));
+    dyn = _micro_module_elf_at(elf, elf->phdrs[i].p_offset,
+                               dyn_count * sizeof(ElfW(Dyn)));
+  }
+  if (!dyn) return MICRO_MODULE_ERROR_NOT_A_MODULE;
+
+  size_t strtab_offset = 0;
+  bool has_symtab = false, has_strtab = false;
+  for (size_t i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; ++i)
+  {
+    switch (dyn[i].d_tag)
+    {
+    case DT_SYMTAB:
+      has_symtab = _micro_module_elf_offset(elf, dyn[i].d_un.d_ptr,
+                                            &elf->symtab_offset);
+      break;
+    case DT_STRTAB:
+      has_strtab = _micro_module_elf_offset(elf, dyn[i].d_un.d_ptr,
+                                            &strtab_offset);
+      break;
+    case DT_GNU_HASH:
+      if (_micro_module_elf_offset(elf, dyn[i].d_un.d_ptr,
+                                   &elf->gnu_hash_offset))
+        elf->gnu_hash = _micro_module_elf_at(elf, elf->gnu_hash_offset,
+                                             4 * sizeof(uint32_t));
+      break;
+    case DT_HASH:
+      if (_micro_module_elf_offset(elf, dyn[i].d_un.d_ptr,
+                                   &elf->sysv_hash_offset))
+        elf->sysv_hash = _micro_module_elf_at(elf, elf->sysv_hash_offset,
+                                              2 * sizeof(uint32_t));
+      break;
+    default:
+      break;
+    }
+  }
+  if (!has_symtab || !has_strtab || (!elf->gnu_hash && !elf->sysv_hash))
+    return MICRO_MODULE_ERROR_NOT_A_MODULE;
+
+  // The string table is bounded by the end of the file
+  elf->strtab      = (const char*)elf->map + strtab_offset;
+  elf->strtab_size = elf->size - strtab_offset;
+  elf->symtab      = (const ElfW(Sym)*)(elf->map + elf->symtab_offset);
+  return MICRO_MODULE_OK;
+}
+
+// Returns the symbol at [i] if it is called [name]
+static const ElfW(Sym) *_micro_module_elf_sym(const _MicroModuleElf *elf,
+                                              size_t i,
+                                              const char *name)
+{
+  const ElfW(Sym) *sym = _micro_module_elf_at(elf,
+    elf->symtab_offset + i * sizeof(ElfW(Sym)), sizeof(ElfW(Sym)));
+  if (!sym || sym->st_name >= elf->strtab_size) return NULL;
+
+  const char *sym_name = elf->strtab + sym->st_name;
+  size_t max = elf->strtab_size - sym->st_name;
+  size_t length = strlen(name);
+  if (length >= max || memcmp(sym_name, name, length + 1) != 0) return NULL;
+  return sym;
+}
+
+// Looks [name] up through the hash tables of the file, the same way
+// the dynamic linker does. Returns NULL if it is not defined.
+static const ElfW(Sym) *_micro_module_elf_lookup(const _MicroModuleElf *elf,
+                                                 const char *name)
+{
+  const ElfW(Sym) *sym = NULL;
+  if (elf->gnu_hash)
+  {
+    uint32_t nbuckets   = elf->gnu_hash[0];
+    uint32_t symoffset  = elf->gnu_hash[1];
+    uint32_t bloom_size = elf->gnu_hash[2];
+    size_t buckets_offset = elf->gnu_hash_offset + 4 * sizeof(uint32_t)
+      + (size_t)bloom_size * sizeof(ElfW(Addr));
+    const uint32_t *buckets = _micro_module_elf_at(elf, buckets_offset,
+      (size_t)nbuckets * sizeof(uint32_t));
+    if (!buckets || nbuckets == 0) return NULL;
+    size_t chain_offset = buckets_offset + (size_t)nbuckets * sizeof(uint32_t);
+
+    uint32_t hash = 5381;
+    for (const char *it = name; *it; ++it)
+      hash = hash * 33 + (unsigned char)*it;
+
+    uint32_t i = buckets[hash % nbuckets];
+    if (i < symoffset) return NULL;
+    for (;; ++i)
+    {
+      const uint32_t *chain = _micro_module_elf_at(elf,
+        chain_offset + (size_t)(i - symoffset) * sizeof(uint32_t),
+        sizeof(uint32_t));
+      if (!chain) return NULL;
+      if ((*chain | 1) == (hash | 1)
+          && (sym = _micro_module_elf_sym(elf, i, name)))
+        break;
+      if (*chain & 1) return NULL;
+    }
+  }
+  else
+  {
+    uint32_t nbuckets = elf->sysv_hash[0];
+    uint32_t nchain   = elf->sysv_hash[1];
+    const uint32_t *table = _micro_module_elf_at(elf, elf->sysv_hash_offset,
+      (2 + (size_t)nbuckets + nchain) * sizeof(uint32_t));
+    if (!table || nbuckets == 0) return NULL;
+
+    uint32_t hash = 0;
+    for (const char *it = name; *it; ++it)
+    {
+      hash = (hash << 4) + (unsigned char)*it;
+      uint32_t high = hash & 0xf0000000;
+      if (high) hash ^= high >> 24;
+      hash &= ~high;
+    }
+
+    // Walk at most [nchain] links, in case the chain loops
+    uint32_t i = table[2 + hash % nbuckets];
+    for (uint32_t steps = 0; i != STN_UNDEF && i < nchain && steps < nchain;
+         ++steps, i = table[2 + nbuckets + i])
+    {
+      if ((sym = _micro_module_elf_sym(elf, i, name)))
+        break;
+    }
+  }
+
+  if (sym && sym->st_shndx == SHN_UNDEF) return NULL;
+  return sym;
+}
+
+// Reads the NT_GNU_BUILD_ID note of the file into [id]
+static void _micro_module_elf_build_id(const _MicroModuleElf *elf,
+                                       MicroModuleFileId *id)
+{
+  for (size_t i = 0; i < elf->phnum; ++i)
+  {
+    const ElfW(Phdr) *phdr = &elf->phdrs[i];
+    if (phdr->p_type != PT_NOTE
+        || !_micro_module_elf_at(elf, phdr->p_offset, phdr->p_filesz))
+      continue;
+
+    size_t align = phdr->p_align == 8 ? 8 : 4;
+    size_t offset = 0;
+    while (offset + sizeof(ElfW(Nhdr)) <= phdr->p_filesz)
+    {
+      const ElfW(Nhdr) *note =
+        (const ElfW(Nhdr)*)(elf->map + phdr->p_offset + offset);
+      size_t name_size = (note->n_namesz + align - 1) & ~(align - 1);
+      size_t desc_size = (note->n_descsz + align - 1) & ~(align - 1);
+      size_t desc = offset + sizeof(ElfW(Nhdr)) + name_size;
+      if (desc > phdr->p_filesz || desc_size > phdr->p_filesz - desc) break;
+
+      const char *name = (const char*)(note + 1);
+      if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4
+          && memcmp(name, "GNU", 4) == 0
+          && note->n_descsz <= MICRO_MODULE_BUILD_ID_MAX)
+      {
+        memcpy(id->build_id, elf->map + phdr->p_offset + desc, note->n_descsz);
+        id->build_id_length = note->n_descsz;
+        return;
+      }
+      offset = desc + desc_size;
+    }
+  }
+}
+
+// Checks that the open file [fd] of [size] bytes is a shared object
+// for this machine defining the symbols required by [mm], without
+// loading it. If [info] is not NULL, it receives the name of the
+// module, its build-id and the offsets of its symbols.
+static int _micro_module_elf_check(MicroModule *mm,
+                                   int fd,
+                                   size_t size,
+                                   _MicroModuleElfInfo *info)
+{
+  if (info)
+  {
+    info->name[0] = '\0';
+    info->file_id.build_id_length = 0;
+    info->independent_offset = 0;
+    info->deps_offset = 0;
+  }
+  if (size < sizeof(ElfW(Ehdr))) return MICRO_MODULE_ERROR_NOT_A_MODULE;
+
+  _MicroModuleElf elf;
+  memset(&elf, 0, sizeof(elf));
+  elf.size = size;
+  elf.map  = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (elf.map == MAP_FAILED) return MICRO_MODULE_ERROR_OPENING_MODULE;
+
+  int err = _micro_module_elf_parse(&elf);
+  const ElfW(Sym) *init_sym = NULL, *exit_sym = NULL, *name_sym = NULL;
+  if (err == MICRO_MODULE_OK
+      && !(init_sym = _micro_module_elf_lookup(&elf, mm->init_fn_symbol)))
+    err = MICRO_MODULE_ERROR_LOCATING_INIT_SYMBOL;
+  if (err == MICRO_MODULE_OK
+      && !(exit_sym = _micro_module_elf_lookup(&elf, mm->exit_fn_symbol)))
+    err = MICRO_MODULE_ERROR_LOCATING_EXIT_SYMBOL;
+  if (err == MICRO_MODULE_OK
+      && !(name_sym = _micro_module_elf_lookup(&elf, mm->name_symbol)))
+    err = MICRO_MODULE_ERROR_LOCATING_NAME_SYMBOL;
+  for (size_t i = 0; err == MICRO_MODULE_OK && mm->symbols
+         && i < mm->symbols_count; ++i)
+  {
+    if (mm->symbols[i].required
+        && !_micro_module_elf_lookup(&elf, mm->symbols[i].name))
+      err = MICRO_MODULE_ERROR_LOCATING_SYMBOL;
+  }
+
+  if (err == MICRO_MODULE_OK && info)
+  {
+    info->init_offset = init_sym->st_value;
+    info->exit_offset = exit_sym->st_value;
+    info->name_offset = name_sym->st_value;
+    const ElfW(Sym) *sym;
+    if (mm->independent_symbol
+        && (sym = _micro_module_elf_lookup(&elf, mm->independent_symbol)))
+      info->independent_offset = sym->st_value;
+    if (mm->deps_symbol
+        && (sym = _micro_module_elf_lookup(&elf, mm->deps_symbol)))
+      info->deps_offset = sym->st_value;
+    _micro_module_elf_build_id(&elf, &info->file_id);
+
+    size_t offset;
+    if (_micro_module_elf_offset(&elf, name_sym->st_value, &offset)
+        && offset < size)
+    {
+      const char *value = (const char*)elf.map + offset;
+      size_t length = strnlen(value, size - offset);
+      if (length < sizeof(info->name) && length < size - offset)
+      {
+        memcpy(info->name, value, length);
+        info->name[length] = '\0';
+      }
+    }
+  }
+
+  munmap((void*)elf.map, size);
+  return err;
+}
+
+// Opens [filename] and checks it with _micro_module_elf_check
+static int _micro_module_check_file(MicroModule *mm,
+                                    const char *filename,
+                                    _MicroModuleElfInfo *info)
+{
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+
+  struct stat st;
+  int err = MICRO_MODULE_ERROR_OPENING_MODULE;
+  if (fstat(fd, &st) == 0)
+  {
+    err = S_ISREG(st.st_mode)
+      ? _micro_module_elf_check(mm, fd, (size_t)st.st_size, info)
+      : MICRO_MODULE_ERROR_NOT_A_MODULE;
+    if (info)
+      _micro_module_file_id_from_stat(&st, &info->file_id);
+  }
+
+  close(fd);
+  return err;
+}
+
+// Returns the program headers of the object loaded at [base], and
+// their number in [phnum], or NULL if no ELF header is mapped there.
+// dl_iterate_phdr only reports the namespace of its caller, so they
+// are read from the ELF header mapped at the base, as for any object
+// linked with its first segment at address 0.
+static const ElfW(Phdr) *_micro_module_loaded_phdrs(uintptr_t base,
+                                                    size_t *phnum)
+{
+  const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr)*)base;
+  if (base == 0
+      || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+      || ehdr->e_type != ET_DYN)
+    return NULL;
+  *phnum = ehdr->e_phnum;
+  return (const ElfW(Phdr)*)(base + ehdr->e_phoff);
+}
+
+// Whether the [length] bytes at [offset] from the load address are in
+// one of the PT_LOAD segments of [phdrs], with the permissions [flags]
+static bool _micro_module_loaded_in(const ElfW(Phdr) *phdrs,
+                                    size_t phnum,
+                                    uint64_t offset,
+                                    uint64_t length,
+                                    uint32_t flags)
+{
+  for (size_t i = 0; i < phnum; ++i)
+  {
+    if (phdrs[i].p_type != PT_LOAD
+        || (phdrs[i].p_flags & flags) != flags)
+      continue;
+    if (offset >= phdrs[i].p_vaddr
+        && offset - phdrs[i].p_vaddr <= phdrs[i].p_memsz
+        && length <= phdrs[i].p_memsz - (offset - phdrs[i].p_vaddr))
+      return true;
+  }
+  return false;
+}
+
+// Whether the symbol offsets of [info] all point into the segments of
+// the object loaded at [base], with the module name at its offset.
+// The manifest may be stale or corrupted, and the offsets are used
+// without any lookup.
+static bool _micro_module_cached_valid(const _MicroModuleElfInfo *info,
+                                       uintptr_t base)
+{
+  size_t phnum;
+  const ElfW(Phdr) *phdrs = _micro_module_loaded_phdrs(base, &phnum);
+  size_t name_size = strlen(info->name) + 1;
+  return phdrs
+    && info->name_offset != 0
+    && _micro_module_loaded_in(phdrs, phnum, info->name_offset,
+                               name_size, PF_R)
+    && memcmp((const char*)(base + info->name_offset), info->name,
+              name_size) == 0
+    && _micro_module_loaded_in(phdrs, phnum, info->init_offset, 1, PF_X)
+    && _micro_module_loaded_in(phdrs, phnum, info->exit_offset, 1, PF_X)
+    && (info->independent_offset == 0
+        || _micro_module_loaded_in(phdrs, phnum, info->independent_offset,
+                                   0, 0))
+    && (info->deps_offset == 0
+        || _micro_module_loaded_in(phdrs, phnum, info->deps_offset,
+                                   sizeof(char*), PF_R));
+}
+
+// Opens the module in [filename] using the symbol offsets of [info]
+// instead of looking its symbols up. Fails if the offsets are not in
+// the segments of the module, or if the name found at the name offset
+// is not the one of [info], so that the caller can open it the usual
+// way.
+static int _micro_module_open_cached(MicroModule *mm,
+                                     const char *filename,
+                                     const _MicroModuleElfInfo *info,
+                                     MicroModuleEntry *module)
+{
+  memset(module, 0, sizeof(*module));
+  if (info->name[0] == '\0') return MICRO_MODULE_ERROR_OPENING_MODULE;
+  _MICRO_MODULE_CLOCK(open_start);
+  int err;
+  module->dlhandler = _micro_module_dlmopen(mm, filename, &err);
+  _MICRO_MODULE_RECORD(mm, &module->stats, MICRO_MODULE_PHASE_OPEN, open_start);
+  if (!module->dlhandler) return err;
+
+  _MICRO_MODULE_CLOCK(symbols_start);
+
+  struct link_map *map;
+  if (dlinfo(module->dlhandler, RTLD_DI_LINKMAP, &map) != 0
+      || !_micro_module_cached_valid(info, map->l_addr)
+      || _micro_module_set_path(mm, module, filename) != MICRO_MODULE_OK)
+  {
+    _micro_module_dlclose(mm, module->dlhandler);
+    module->dlhandler = NULL;
+    return MICRO_MODULE_ERROR_OPENING_MODULE;
+  }
+
+  uintptr_t base = map->l_addr;
+  module->name = (char*)(base + info->name_offset);
+  *(void**)(&module->init_fn) = (void*)(base + info->init_offset);
+  *(void**)(&module->exit_fn) = (void*)(base + info->exit_offset);
+  module->independent = info->independent_offset != 0;
+  if (info->deps_offset)
+    module->deps = (const char *const *)(base + info->deps_offset);
+  module->file_id = info->file_id;
+
+  err = _micro_module_resolve_symbols(mm, module);
+  if (err != MICRO_MODULE_OK)
+  {
+    _micro_module_close(mm, module);
+    return err;
+  }
+  _MICRO_MODULE_RECORD(mm, &module->stats, MICRO_MODULE_PHASE_SYMBOLS,
+                       symbols_start);
+  return MICRO_MODULE_OK;
+}
+
+// Asks the kernel to read [filename] ahead, so the following dlmopen
+// finds it in the page cache, and checks that it looks like a module.
+// If MicroModule.check_files is set, the file is checked through its
+// ELF headers (see micro_module_check) and [rejected] is set when it
+// failed that check. Otherwise only the ELF magic is checked. If [info]
+// is not NULL, the ELF headers are read into it in any case, and
+// [has_info] tells if that worked.
+static int _micro_module_prefetch(MicroModule *mm,
+                                  const char *filename,
+                                  bool *rejected,
+                                  _MicroModuleElfInfo *info,
+                                  bool *has_info)
+{
+  *rejected = false;
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+
+  int err = MICRO_MODULE_OK;
+  struct stat st;
+  unsigned char ident[SELFMAG];
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    err = MICRO_MODULE_ERROR_OPENING_MODULE;
+  }
+  else if (mm->check_files || info)
+  {
+    posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+    err = _micro_module_elf_check(mm, fd, (size_t)st.st_size, info);
+    if (info)
+    {
+      _micro_module_file_id_from_stat(&st, &info->file_id);
+      *has_info = err == MICRO_MODULE_OK;
+    }
+    *rejected = mm->check_files && err != MICRO_MODULE_OK
+      && err != MICRO_MODULE_ERROR_OPENING_MODULE;
+    if (!mm->check_files)
+      err = MICRO_MODULE_OK;
+  }
+  else if (pread(fd, ident, SELFMAG, 0) != SELFMAG
+           || memcmp(ident, ELFMAG, SELFMAG) != 0)
+  {
+    err = MICRO_MODULE_ERROR_OPENING_MODULE;
+  }
+  else
+  {
+    posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+  }
+
+  close(fd);
+  return err;
+}
+
+// Runs [fn] with [ctx] on the calling thread and on up to [nthreads] - 1
+// new threads, returning when all of them are done. [fn] is expected to
+// pull work from [ctx] until there is none left, so it is fine if some
+// of the threads could not be created.
+static void _micro_module_run_threads(unsigned int nthreads,
+                                      void *(*fn)(void*),
+                                      void *ctx)
+{
+  pthread_t threads[MICRO_MODULE_MAX_THREADS];
+  unsigned int started = 0;
+  if (nthreads > MICRO_MODULE_MAX_THREADS)
+    nthreads = MICRO_MODULE_MAX_THREADS;
+
+  while (started + 1 < nthreads
+         && pthread_create(&threads[started], NULL, fn, ctx) == 0)
+    started++;
+
+  fn(ctx);
+
+  for (unsigned int i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+}
+
+// A file of a directory loaded as a batch
+typedef struct {
+  char *path;
+  MicroModuleEntry module;
+  // Result of loading the file
+  int err;
+  // Whether the file failed the checks of MicroModule.check_files
+  bool rejected;
+  // Whether the module was added to the registry
+  bool registered;
+  // What is known about the file, for the manifest
+  _MicroModuleElfInfo info;
+  bool has_info;
+  // Whether [info] comes from the manifest
+  bool cached;
+  // Error of a file rejected according to the manifest
+  int cached_err;
+} _MicroModuleBatchItem;
+
+// Modules of a directory, loaded together
+typedef struct {
+  MicroModule *mm;
+  void *arg;
+  _MicroModuleBatchItem *items;
+  size_t count;
+  size_t capacity;
+  // Next item to be claimed by a worker, and to be read ahead
+  size_t next;
+  size_t warm_next;
+  // Items rejected by MicroModule.check_files, kept for the manifest
+  _MicroModuleBatchItem *rejected;
+  size_t rejected_count;
+  // Identity of the directory before it was read
+  MicroModuleFileId dir_id;
+  // Whether the batch differs from the manifest
+  bool changed;
+} _MicroModuleBatch;
+
+static void _micro_module_batch_free(_MicroModuleBatch *batch)
+{
+  for (size_t i = 0; i < batch->count; ++i)
+    _micro_module_free(batch->mm, batch->items[i].path);
+  for (size_t i = 0; i < batch->rejected_count; ++i)
+    _micro_module_free(batch->mm, batch->rejected[i].path);
+  _micro_module_free(batch->mm, batch->items);
+  _micro_module_free(batch->mm, batch->rejected);
+  batch->items    = NULL;
+  batch->rejected = NULL;
+  batch->count = batch->capacity = batch->rejected_count = 0;
+}
+
+// Moves the items rejected by MicroModule.check_files out of the
+// batch, reporting them to MicroModule.skip_fn in directory order
+static int _micro_module_batch_skip_rejected(_MicroModuleBatch *batch)
+{
+  size_t rejected = 0;
+  for (size_t i = 0; i < batch->count; ++i)
+    rejected += batch->items[i].rejected;
+  if (rejected == 0) return MICRO_MODULE_OK;
+
+  batch->rejected =
+    _micro_module_alloc(batch->mm, rejected * sizeof(_MicroModuleBatchItem));
+  if (!batch->rejected) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < batch->count; ++i)
+  {
+    _MicroModuleBatchItem *item = &batch->items[i];
+    if (!item->rejected)
+    {
+      batch->items[kept++] = *item;
+      continue;
+    }
+    if (batch->mm->skip_fn)
+      batch->mm->skip_fn(item->path, item->err, batch->mm->skip_arg);
+    batch->rejected[batch->rejected_count++] = *item;
+  }
+  batch->count = kept;
+  return MICRO_MODULE_OK;
+}
+
+static int _micro_module_batch_add(_MicroModuleBatch *batch, const char *path)
+{
+  if (batch->count == batch->capacity)
+  {
+    size_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+    _MicroModuleBatchItem *items =
+      _micro_module_alloc(batch->mm, capacity * sizeof(_MicroModuleBatchItem));
+    if (!items) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    if (batch->count)
+      memcpy(items, batch->items, batch->count * sizeof(_MicroModuleBatchItem));
+    _micro_module_free(batch->mm, batch->items);
+    batch->items    = items;
+    batch->capacity = capacity;
+  }
+
+  size_t length = strlen(path) + 1;
+  char *copy = _micro_module_alloc(batch->mm, length);
+  if (!copy) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  memcpy(copy, path, length);
+
+  _MicroModuleBatchItem *item = &batch->items[batch->count++];
+  memset(item, 0, sizeof(*item));
+  item->path = copy;
+  return MICRO_MODULE_OK;
+}
+
+// Collects the files at the top level of [modules_dir] into [batch],
+// in the order returned by fts
+static int _micro_module_batch_scan(_MicroModuleBatch *batch,
+                                    char *modules_dir)
+{
+  int err = MICRO_MODULE_OK;
+  char *path_argv[] = { modules_dir, NULL };
+  FTSENT *file_entry = NULL;
+  _MICRO_MODULE_CLOCK(scan_start);
   FTS *files = fts_open(path_argv, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
   if (!files) return MICRO_MODULE_ERROR_OPEN_MODULES_DIR;
 
-  while ((file_entry = fts_read(files)))
+  while (err == MICRO_MODULE_OK && (file_entry = fts_read(files)))
+  {
+    switch (file_entry->fts_info)
+    {
+    case FTS_D: // Directory
+      // Skip descending into subdirectories
+      if (file_entry->fts_level > 0)
+        fts_set(files, file_entry, FTS_SKIP);
+      break;
+    case FTS_F:  // Regular file
+    case FTS_SL: // Symbolic link
+    case FTS_DEFAULT:
+      if (file_entry->fts_level == 1)
+        err = _micro_module_batch_add(batch, file_entry->fts_path);
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (fts_close(files) < 0 && err == MICRO_MODULE_OK)
+    err = MICRO_MODULE_ERROR_CLOSE_MODULES_DIR;
+  _MICRO_MODULE_RECORD(batch->mm, NULL, MICRO_MODULE_PHASE_SCAN, scan_start);
+  return err;
+}
+
+// Asks the kernel to read ahead the files of the batch [ctx]
+static void *_micro_module_batch_warm_up_worker(void *ctx)
+{
+  _MicroModuleBatch *batch = ctx;
+  size_t i;
+  while ((i = __atomic_fetch_add(&batch->warm_next, 1, __ATOMIC_RELAXED))
+         < batch->count)
+  {
+    int fd = open(batch->items[i].path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+  return NULL;
+}
+
+static int _micro_module_open_file(MicroModule *mm,
+                                   const char *filename,
+                                   const _MicroModuleElfInfo *info,
+                                   MicroModuleEntry *module);
+
+// Worker loading the items of a batch
+static void *_micro_module_batch_load_worker(void *ctx)
+{
+  _MicroModuleBatch *batch = ctx;
+  size_t i;
+  while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED))
+         < batch->count)
+  {
+    _MicroModuleBatchItem *item = &batch->items[i];
+    MicroModule *mm = batch->mm;
+    if (item->cached)
+    {
+      // Trust the manifest if the file did not change
+      MicroModuleFileId id;
+      if (_micro_module_file_id(item->path, &id)
+          && _micro_module_file_id_equal(&id, &item->info.file_id))
+      {
+        item->err = item->cached_err;
+        item->rejected = item->cached_err != MICRO_MODULE_OK;
+        if (!item->rejected)
+          item->err = _micro_module_open_file(mm, item->path,
+                                              &item->info, &item->module);
+        if (item->err == MICRO_MODULE_OK || item->rejected) continue;
+      }
+      item->cached = false;
+      __atomic_store_n(&batch->changed, true, __ATOMIC_RELAXED);
+    }
+
+    _MICRO_MODULE_CLOCK(check_start);
+    item->err = _micro_module_prefetch(mm, item->path, &item->rejected,
+                                       mm->manifest_path ? &item->info : NULL,
+                                       &item->has_info);
+    _MICRO_MODULE_RECORD(mm, NULL, MICRO_MODULE_PHASE_CHECK, check_start);
+    if (item->err == MICRO_MODULE_OK)
+      item->err = _micro_module_open_file(mm, item->path, NULL, &item->module);
+    if (item->err == MICRO_MODULE_OK && item->has_info)
+    {
+      // Keep the build-id if the file did not change since its check
+      if (_micro_module_file_id_equal(&item->module.file_id, &item->info.file_id))
+        item->module.file_id = item->info.file_id;
+      else
+        item->has_info = false;
+    }
+  }
+  return NULL;
+}
+
+// Splits [line] at tabs into up to [max] [fields], dropping the
+// trailing newline. Returns the number of fields.
+static size_t _micro_module_manifest_split(char *line, char **fields, size_t max)
+{
+  line[strcspn(line, "\n")] = '\0';
+  size_t count = 0;
+  while (count < max)
+  {
+    fields[count++] = line;
+    line = strchr(line, '\t');
+    if (!line) break;
+    *line++ = '\0';
+  }
+  return count;
+}
+
+static bool _micro_module_manifest_number(const char *field, uint64_t *value)
+{
+  char *end;
+  *value = strtoull(field, &end, 10);
+  return end != field && *end == '\0';
+}
+
+// Reads the fields of a file identity starting at [fields]
+static bool _micro_module_manifest_file_id(char **fields,
+                                           MicroModuleFileId *id)
+{
+  uint64_t mtime_sec, mtime_nsec;
+  memset(id, 0, sizeof(*id));
+  if (!_micro_module_manifest_number(fields[0], &id->dev)
+      || !_micro_module_manifest_number(fields[1], &id->ino)
+      || !_micro_module_manifest_number(fields[2], &mtime_sec)
+      || !_micro_module_manifest_number(fields[3], &mtime_nsec)
+      || !_micro_module_manifest_number(fields[4], &id->size))
+    return false;
+  id->mtime_sec  = (int64_t)mtime_sec;
+  id->mtime_nsec = (int64_t)mtime_nsec;
+  return true;
+}
+
+static void _micro_module_manifest_print_file_id(FILE *file,
+                                                 const MicroModuleFileId *id)
+{
+  fprintf(file, "%llu\t%llu\t%llu\t%llu\t%llu",
+          (unsigned long long)id->dev, (unsigned long long)id->ino,
+          (unsigned long long)id->mtime_sec, (unsigned long long)id->mtime_nsec,
+          (unsigned long long)id->size);
+}
+
+// Writes the configuration line, which must match for a manifest to
+// be used
+static void _micro_module_manifest_print_config(FILE *file, MicroModule *mm)
+{
+  fprintf(file, "config\t%s\t%s\t%s\t%s\t%s\t%d",
+          mm->name_symbol, mm->init_fn_symbol, mm->exit_fn_symbol,
+          mm->independent_symbol ? mm->independent_symbol : "",
+          mm->deps_symbol ? mm->deps_symbol : "",
+          mm->check_files ? 1 : 0);
+  // The required symbols decide which files are rejected
+  for (size_t i = 0; mm->symbols && i < mm->symbols_count; ++i)
+    if (mm->symbols[i].required)
+      fprintf(file, "\t%s", mm->symbols[i].name);
+  fputc('\n', file);
+}
+
+#define _MICRO_MODULE_MANIFEST_HEADER "micro-module-manifest 1\n"
+
+// Fills [batch] from the manifest if it describes [modules_dir] as it
+// is now. Returns false, leaving [batch] empty, otherwise.
+//
+// The manifest is a text file with one tab separated record per line:
+//
+//   micro-module-manifest 1
+//   config  <symbols>  <check_files>
+//   dir     <file id>  <path>
+//   module  <file id>  <build-id>  <symbol offsets>  <name>  <path>
+//   skip    <file id>  <error>  <path>
+//
+// where a file id is the device, inode, mtime seconds, mtime
+// nanoseconds and size of a file.
+static bool _micro_module_manifest_read(_MicroModuleBatch *batch,
+                                        const char *modules_dir)
+{
+  MicroModule *mm = batch->mm;
+  FILE *file = fopen(mm->manifest_path, "re");
+  if (!file) return false;
+
+  char *expected = NULL;
+  size_t expected_size;
+  FILE *config = open_memstream(&expected, &expected_size);
+  if (!config)
+  {
+    fclose(file);
+    return false;
+  }
+  _micro_module_manifest_print_config(config, mm);
+  if (fclose(config) != 0)
+  {
+    free(expected);
+    fclose(file);
+    return false;
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  bool valid = getline(&line, &line_size, file) > 0
+    && strcmp(line, _MICRO_MODULE_MANIFEST_HEADER) == 0
+    && getline(&line, &line_size, file) > 0
+    && strcmp(line, expected) == 0;
+
+  char *fields[16];
+  MicroModuleFileId id;
+  if (valid)
+  {
+    valid = getline(&line, &line_size, file) > 0
+      && _micro_module_manifest_split(line, fields, 16) == 7
+      && strcmp(fields[0], "dir") == 0
+      && _micro_module_manifest_file_id(fields + 1, &id)
+      && strcmp(fields[6], modules_dir) == 0
+      && _micro_module_file_id_equal(&id, &batch->dir_id);
+  }
+
+  while (valid && getline(&line, &line_size, file) > 0)
+  {
+    size_t count = _micro_module_manifest_split(line, fields, 16);
+    valid = count >= 2 && _micro_module_batch_add(batch, fields[count - 1])
+      == MICRO_MODULE_OK;
+    if (!valid) break;
+
+    _MicroModuleBatchItem *item = &batch->items[batch->count - 1];
+    _MicroModuleElfInfo *info = &item->info;
+    item->cached   = true;
+    item->has_info = true;
+    if (count == 8 && strcmp(fields[0], "skip") == 0)
+    {
+      long err = strtol(fields[6], NULL, 10);
+      item->cached_err = (int)err;
+      valid = _micro_module_manifest_file_id(fields + 1, &info->file_id)
+        && err < 0;
+    }
+    else if (count == 14 && strcmp(fields[0], "module") == 0)
+    {
+      valid = _micro_module_manifest_file_id(fields + 1, &info->file_id)
+        && _micro_module_manifest_number(fields[7], &info->name_offset)
+        && _micro_module_manifest_number(fields[8], &info->init_offset)
+        && _micro_module_manifest_number(fields[9], &info->exit_offset)
+        && _micro_module_manifest_number(fields[10], &info->independent_offset)
+        && _micro_module_manifest_number(fields[11], &info->deps_offset)
+        && strlen(fields[12]) < sizeof(info->name);
+      if (!valid) break;
+      strcpy(info->name, fields[12]);
+
+      // Build-id in hexadecimal, or "-"
+      const char *hex = fields[6];
+      size_t length = strcmp(hex, "-") == 0 ? 0 : strlen(hex) / 2;
+      valid = length <= MICRO_MODULE_BUILD_ID_MAX;
+      for (size_t i = 0; valid && i < length; ++i)
+      {
+        unsigned int byte;
+        valid = sscanf(hex + i * 2, "%2x", &byte) == 1;
+        info->file_id.build_id[i] = (unsigned char)byte;
+      }
+      info->file_id.build_id_length = length;
+    }
+    else
+    {
+      valid = false;
+    }
+  }
+
+  free(line);
+  free(expected);
+  fclose(file);
+  if (!valid)
+    _micro_module_batch_free(batch);
+  return valid;
+}
+
+// Writes the manifest of the registered items of [batch], replacing
+// the old one atomically
+static int _micro_module_manifest_write(_MicroModuleBatch *batch,
+                                        const char *modules_dir)
+{
+  MicroModule *mm = batch->mm;
+  bool valid = strpbrk(modules_dir, "\t\n") == NULL;
+  for (size_t i = 0; i < batch->count && valid; ++i)
+  {
+    _MicroModuleBatchItem *item = &batch->items[i];
+    if (item->registered)
+      valid = item->has_info && strpbrk(item->path, "\t\n") == NULL
+        && strpbrk(item->info.name, "\t\n") == NULL;
+  }
+  for (size_t i = 0; i < batch->rejected_count && valid; ++i)
+    valid = strpbrk(batch->rejected[i].path, "\t\n") == NULL;
+  if (!valid) return MICRO_MODULE_ERROR_WRITING_MANIFEST;
+
+  size_t length = strlen(mm->manifest_path);
+  char *tmp_path = _micro_module_alloc(mm, length + sizeof(".tmp"));
+  if (!tmp_path) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  memcpy(tmp_path, mm->manifest_path, length);
+  memcpy(tmp_path + length, ".tmp", sizeof(".tmp"));
+
+  FILE *file = fopen(tmp_path, "we");
+  if (!file)
+  {
+    _micro_module_free(mm, tmp_path);
+    return MICRO_MODULE_ERROR_WRITING_MANIFEST;
+  }
+
+  fputs(_MICRO_MODULE_MANIFEST_HEADER, file);
+  _micro_module_manifest_print_config(file, mm);
+  fputs("dir\t", file);
+  _micro_module_manifest_print_file_id(file, &batch->dir_id);
+  fprintf(file, "\t%s\n", modules_dir);
+
+  for (size_t i = 0; i < batch->rejected_count; ++i)
+  {
+    _MicroModuleBatchItem *item = &batch->rejected[i];
+    fputs("skip\t", file);
+    _micro_module_manifest_print_file_id(file, &item->info.file_id);
+    fprintf(file, "\t%d\t%s\n", item->err, item->path);
+  }
+
+  for (size_t i = 0; i < batch->count; ++i)
+  {
+    _MicroModuleBatchItem *item = &batch->items[i];
+    if (!item->registered) continue;
+    const _MicroModuleElfInfo *info = &item->info;
+    fputs("module\t", file);
+    _micro_module_manifest_print_file_id(file, &info->file_id);
+    fputc('\t', file);
+    for (size_t b = 0; b < info->file_id.build_id_length; ++b)
+      fprintf(file, "%02x", info->file_id.build_id[b]);
+    if (info->file_id.build_id_length == 0)
+      fputc('-', file);
+    fprintf(file, "\t%llu\t%llu\t%llu\t%llu\t%llu\t%s\t%s\n",
+            (unsigned long long)info->name_offset,
+            (unsigned long long)info->init_offset,
+            (unsigned long long)info->exit_offset,
+            (unsigned long long)info->independent_offset,
+            (unsigned long long)info->deps_offset,
+            info->name, item->path);
+  }
+
+  int err = MICRO_MODULE_OK;
+  if (ferror(file) | (fclose(file) != 0)
+      || rename(tmp_path, mm->manifest_path) != 0)
+  {
+    unlink(tmp_path);
+    err = MICRO_MODULE_ERROR_WRITING_MANIFEST;
+  }
+  _micro_module_free(mm, tmp_path);
+  return err;
+}
+
+// Points the stubs of the module called [name] to the symbols of
+// [dlhandler], or to NULL if [dlhandler] is NULL
+static void _micro_module_retarget(MicroModule *mm,
+                                   const char *name,
+                                   void *dlhandler)
+{
+  if (!mm->stubs) return;
+  size_t length;
+  uint32_t hash = _micro_module_hash(name, &length);
+  pthread_mutex_lock(&mm->lock);
+  for (MicroModuleStub *stub = mm->stubs; stub; stub = stub->next)
+  {
+    if (stub->hash != hash || strcmp(stub->module_name, name) != 0)
+      continue;
+    void *address = dlhandler ? dlsym(dlhandler, stub->symbol) : NULL;
+    __atomic_store_n(&stub->address, address, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&mm->lock);
+}
+
+// Puts [node] in place of the node of [slot] in the list and the
+// index, and returns the old node, to be retired by the caller, once
+// it is no longer being loaded. Must be called with MicroModule.lock
+// held.
+static MicroModuleList *_micro_module_swap(MicroModule *mm,
+                                           MicroModuleIndexSlot *slot,
+                                           MicroModuleList *node)
+{
+  MicroModuleList *old = slot->node;
+  node->prev = old->prev;
+  node->next = old->next;
+  if (old->next)
+    old->next->prev = node;
+  // Readers walking the list through [old] still find the rest of it
+  if (old->prev)
+    __atomic_store_n(&old->prev->next, node, __ATOMIC_RELEASE);
+  else
+    __atomic_store_n(&mm->modules, node, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->node, node, __ATOMIC_RELEASE);
+  _micro_module_wait_loading(mm, old);
+  return old;
+}
+
+// Adds [node], whose name has [hash] and [length], at the head of the
+// list and to the index, which must have been reserved. Must be called
+// with MicroModule.lock held.
+static void _micro_module_link(MicroModule *mm,
+                               MicroModuleList *node,
+                               uint32_t hash,
+                               size_t length)
+{
+  node->prev = NULL;
+  node->next = mm->modules;
+  if (mm->modules)
+    mm->modules->prev = node;
+  __atomic_store_n(&mm->modules, node, __ATOMIC_RELEASE);
+  _micro_module_index_insert(mm->index, node, hash, length);
+}
+
+// Registers [module], initialized already unless it is lazy, so that
+// readers never get a module whose init function did not return yet.
+// A module registered with the same name meanwhile is replaced: it is
+// exited with [arg] and closed, once it was unlinked and without
+// holding MicroModule.lock, as draining it may wait for calls that
+// need the lock. If [module] cannot be registered, it is exited and
+// closed.
+static int _micro_module_register(MicroModule *mm,
+                                  MicroModuleEntry *module,
+                                  void *arg)
+{
+  size_t length;
+  uint32_t hash = _micro_module_hash(module->name, &length);
+  pthread_mutex_lock(&mm->lock);
+
+  // Check if module was already registered
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(mm->index, module->name, hash, length);
+  if (slot)
+  {
+    // Readers may be using the old entry, replace it by a new node
+    MicroModuleList *node = _micro_module_node_new(mm);
+    if (!node) goto fail;
+    node->module = *module;
+    MicroModuleList *old = _micro_module_swap(mm, slot, node);
+    bool loaded = _micro_module_is_loaded(&old->module);
+    if (loaded)
+      _micro_module_retarget(mm, old->module.name, NULL);
+    _MICRO_MODULE_RELOAD(mm, &node->module, &old->module);
+    pthread_mutex_unlock(&mm->lock);
+
+    // Exit the loaded module
+    if (loaded)
+    {
+      _micro_module_drain(&old->module);
+      _MICRO_MODULE_CLOCK(exit_start);
+      old->module.exit_fn(arg);
+      _MICRO_MODULE_RECORD(mm, _micro_module_stats_find(mm, module->name),
+                           MICRO_MODULE_PHASE_EXIT, exit_start);
+    }
+
+    // Closing it may only fail in dlclose, which leaves it mapped but
+    // does not prevent the new version from being used
+    pthread_mutex_lock(&mm->lock);
+    _micro_module_retire(mm, &old->retired, _micro_module_node_free);
+    goto exit;
+  }
+
+  // Add to the module list
+  MicroModuleList *new_module = NULL;
+  if (_micro_module_index_reserve(mm) == MICRO_MODULE_OK)
+    new_module = _micro_module_node_new(mm);
+  if (!new_module) goto fail;
+  new_module->module = *module;
+  _micro_module_link(mm, new_module, hash, length);
+
+ exit:
+  pthread_mutex_unlock(&mm->lock);
+  return MICRO_MODULE_OK;
+
+ fail:
+  pthread_mutex_unlock(&mm->lock);
+  if (_micro_module_is_loaded(module))
+    module->exit_fn(arg);
+  _micro_module_close(mm, module);
+  return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+}
+
+// Unlinks [slot] from the index and the list, and returns its node,
+// to be retired by the caller, once it is no longer being loaded.
+// Must be called with MicroModule.lock held.
+static MicroModuleList *_micro_module_unlink(MicroModule *mm,
+                                             MicroModuleIndexSlot *slot)
+{
+  MicroModuleList *it = slot->node;
+  if (it->next)
+    it->next->prev = it->prev;
+  // Readers standing on [it] can still move to the next node
+  if (it->prev)
+    __atomic_store_n(&it->prev->next, it->next, __ATOMIC_RELEASE);
+  else
+    __atomic_store_n(&mm->modules, it->next, __ATOMIC_RELEASE);
+
+  _micro_module_index_remove(mm->index, slot);
+  _micro_module_wait_loading(mm, it);
+  return it;
+}
+
+// Unlinks the module registered with the name of [module], if any,
+// then exits it with [arg] and retires it, before [module] gets
+// initialized to replace it: dlmopen may have returned its very
+// instance, whose exit function has to run before its init function.
+// Meanwhile, readers get no module of that name.
+static void _micro_module_exit_replaced(MicroModule *mm,
+                                        MicroModuleEntry *module,
+                                        void *arg)
+{
+  size_t length;
+  uint32_t hash = _micro_module_hash(module->name, &length);
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(mm->index, module->name, hash, length);
+  if (!slot)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return;
+  }
+  MicroModuleList *old = _micro_module_unlink(mm, slot);
+  bool loaded = _micro_module_is_loaded(&old->module);
+  if (loaded)
+    _micro_module_retarget(mm, old->module.name, NULL);
+  _MICRO_MODULE_RELOAD(mm, module, &old->module);
+  pthread_mutex_unlock(&mm->lock);
+
+  if (loaded)
+  {
+    _micro_module_drain(&old->module);
+    _MICRO_MODULE_CLOCK(exit_start);
+    old->module.exit_fn(arg);
+    _MICRO_MODULE_RECORD(mm, &module->stats, MICRO_MODULE_PHASE_EXIT,
+                         exit_start);
+  }
+
+  // Closing it may only fail in dlclose, which leaves it mapped but
+  // does not prevent the new version from being used
+  pthread_mutex_lock(&mm->lock);
+  _micro_module_retire(mm, &old->retired, _micro_module_node_free);
+  pthread_mutex_unlock(&mm->lock);
+}
+
+// Stages the reload of the module registered with the name of
+// [module] by [module]: initializes [module] first, then swaps it in
+// and retires the old version. On failure, [module] is closed and the
+// old version is kept. The result is stored in [err].
+//
+// Returns false, without touching [module], if no module of that name
+// is registered, or if [module] has the handle of the registered one:
+// dlmopen returns the loaded instance for a file that is still loaded
+// in the same namespace, whose init function would then run twice and
+// its exit function last.
+static bool _micro_module_reload_staged(MicroModule *mm,
+                                        MicroModuleEntry *module,
+                                        void *arg,
+                                        int *err)
+{
+  size_t length;
+  uint32_t hash = _micro_module_hash(module->name, &length);
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(mm->index, module->name, hash, length);
+  bool staged = slot && slot->node->module.dlhandler != module->dlhandler;
+  pthread_mutex_unlock(&mm->lock);
+  if (!staged) return false;
+
+  // Allocate first, nothing may fail after the new version initialized
+  MicroModuleList *node = _micro_module_node_new(mm);
+  if (!node)
+  {
+    _micro_module_close(mm, module);
+    *err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    return true;
+  }
+
+  _MICRO_MODULE_CLOCK(init_start);
+  *err = module->init_fn(arg);
+  _MICRO_MODULE_RECORD(mm, &module->stats, MICRO_MODULE_PHASE_INIT,
+                       init_start);
+  if (*err != 0)
+  {
+    _micro_module_close(mm, module);
+    _micro_module_node_release(mm, node);
+    return true;
+  }
+  _MICRO_MODULE_COUNT(mm, &module->stats, loads);
+
+  // Put the new node in place of the old one, and exit the old one
+  // once nobody can get it through micro_module_get anymore. The old
+  // one may have been unloaded meanwhile.
+  pthread_mutex_lock(&mm->lock);
+  node->module = *module;
+  MicroModuleList *old = NULL;
+  slot = _micro_module_index_find(mm->index, module->name, hash, length);
+  if (slot)
+  {
+    old = _micro_module_swap(mm, slot, node);
+    _MICRO_MODULE_RELOAD(mm, &node->module, &old->module);
+  }
+  else if (_micro_module_index_reserve(mm) == MICRO_MODULE_OK)
+  {
+    _micro_module_link(mm, node, hash, length);
+  }
+  else
+  {
+    pthread_mutex_unlock(&mm->lock);
+    module->exit_fn(arg);
+    _micro_module_close(mm, module);
+    _micro_module_node_release(mm, node);
+    *err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    return true;
+  }
+  _micro_module_retarget(mm, node->module.name, node->module.dlhandler);
+  pthread_mutex_unlock(&mm->lock);
+  *err = MICRO_MODULE_OK;
+  if (!old) return true;
+
+  if (_micro_module_is_loaded(&old->module))
+  {
+    _micro_module_drain(&old->module);
+    _MICRO_MODULE_CLOCK(exit_start);
+    old->module.exit_fn(arg);
+    _MICRO_MODULE_RECORD(mm, &node->module.stats, MICRO_MODULE_PHASE_EXIT,
+                         exit_start);
+  }
+  if (!mm->concurrent && _micro_module_close(mm, &old->module) != MICRO_MODULE_OK)
+    *err = MICRO_MODULE_ERROR_CLOSING_MODULE;
+  pthread_mutex_lock(&mm->lock);
+  _micro_module_retire(mm, &old->retired, _micro_module_node_free);
+  pthread_mutex_unlock(&mm->lock);
+  return true;
+}
+
+// Marks an entry superseded by a later one with the same name
+#define _MICRO_MODULE_SUPERSEDED ((size_t)-1)
+
+// Returns the position plus one of the entry called [name] in the
+// table of _micro_module_schedule, or 0 if there is none
+static size_t _micro_module_schedule_find(const size_t *table,
+                                          size_t mask,
+                                          MicroModuleEntry **entries,
+                                          const char *name)
+{
+  size_t length;
+  size_t j = _micro_module_hash(name, &length) & mask;
+  while (table[j] && strcmp(entries[table[j] - 1]->name, name) != 0)
+    j = (j + 1) & mask;
+  return table[j];
+}
+
+// Schedules [entries] by the dependencies they declare through
+// MicroModule.deps_symbol. A module gets a higher level than all the
+// modules it depends on, so modules of the same level can be called
+// concurrently.
+//
+// On success [order] holds the positions of the scheduled entries
+// sorted by level, their number is stored in [scheduled], and [levels]
+// holds the level of each entry. If several entries have the same
+// name only the last one is scheduled, the others get the level
+// _MICRO_MODULE_SUPERSEDED. Dependencies that are not in [entries] must
+// be registered in [mm] if [check_registry] is set, and are ignored
+// otherwise.
+static int _micro_module_schedule(MicroModule *mm,
+                                  MicroModuleEntry **entries,
+                                  size_t count,
+                                  bool check_registry,
+                                  size_t *order,
+                                  size_t *levels,
+                                  size_t *scheduled)
+{
+  size_t capacity = 1;
+  while (capacity < count * 2)
+    capacity *= 2;
+  size_t edges_count = 0;
+  for (size_t i = 0; i < count; ++i)
+    for (const char *const *dep = entries[i]->deps; dep && *dep; ++dep)
+      edges_count++;
+
+  // The entries by name (position plus one), the number of unscheduled
+  // dependencies of each entry, and the dependents of each entry as
+  // offsets into [edges]
+  size_t *table = _micro_module_alloc(mm, (capacity + count * 3 + 1
+                                           + edges_count) * sizeof(size_t));
+  if (!table) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  size_t *pending = table + capacity;
+  size_t *offsets = pending + count;
+  size_t *cursor  = offsets + count + 1;
+  size_t *edges   = cursor + count;
+  memset(table, 0, (capacity + count * 2 + 1) * sizeof(size_t));
+
+  size_t mask = capacity - 1;
+  *scheduled = count;
+  for (size_t i = 0; i < count; ++i)
+  {
+    size_t length;
+    size_t j = _micro_module_hash(entries[i]->name, &length) & mask;
+    levels[i] = 0;
+    while (table[j] && strcmp(entries[table[j] - 1]->name, entries[i]->name) != 0)
+      j = (j + 1) & mask;
+    if (table[j])
+    {
+      levels[table[j] - 1] = _MICRO_MODULE_SUPERSEDED;
+      (*scheduled)--;
+    }
+    table[j] = i + 1;
+  }
+
+  int err = MICRO_MODULE_OK;
+  for (size_t pass = 0; pass < 2 && err == MICRO_MODULE_OK; ++pass)
+  {
+    for (size_t i = 0; i < count && err == MICRO_MODULE_OK; ++i)
+    {
+      if (levels[i] == _MICRO_MODULE_SUPERSEDED) continue;
+      for (const char *const *dep = entries[i]->deps; dep && *dep; ++dep)
+      {
+        size_t found = _micro_module_schedule_find(table, mask, entries, *dep);
+        if (found == i + 1)
+        {
+          err = MICRO_MODULE_ERROR_DEPENDENCY_CYCLE;
+          break;
+        }
+        if (!found)
+        {
+          if (check_registry && !micro_module_get(mm, *dep))
+          {
+            err = MICRO_MODULE_ERROR_MISSING_DEPENDENCY;
+            break;
+          }
+          continue;
+        }
+        if (pass == 0)
+        {
+          pending[i]++;
+          offsets[found]++;
+        }
+        else
+        {
+          edges[cursor[found - 1]++] = i;
+        }
+      }
+    }
+    if (pass == 0)
+    {
+      for (size_t i = 0; i < count; ++i)
+        offsets[i + 1] += offsets[i];
+      memcpy(cursor, offsets, count * sizeof(size_t));
+    }
+  }
+
+  // Kahn's algorithm, using [order] as the queue
+  size_t head = 0, tail = 0;
+  for (size_t i = 0; i < count && err == MICRO_MODULE_OK; ++i)
+    if (levels[i] != _MICRO_MODULE_SUPERSEDED && pending[i] == 0)
+      order[tail++] = i;
+  size_t max_level = 0;
+  while (head < tail)
+  {
+    size_t i = order[head++];
+    for (size_t e = offsets[i]; e < offsets[i + 1]; ++e)
+    {
+      size_t k = edges[e];
+      if (levels[k] < levels[i] + 1)
+        levels[k] = levels[i] + 1;
+      if (levels[k] > max_level)
+        max_level = levels[k];
+      if (--pending[k] == 0)
+        order[tail++] = k;
+    }
+  }
+  if (err == MICRO_MODULE_OK && tail != *scheduled)
+    err = MICRO_MODULE_ERROR_DEPENDENCY_CYCLE;
+
+  // Sort by level, keeping the original order inside a level
+  if (err == MICRO_MODULE_OK && max_level > 0)
+  {
+    size_t k = 0;
+    for (size_t level = 0; level <= max_level; ++level)
+      for (size_t i = 0; i < count; ++i)
+        if (levels[i] == level)
+          order[k++] = i;
+  }
+
+  _micro_module_free(mm, table);
+  return err;
+}
+
+// Init or exit function calls of a range of scheduled modules
+typedef struct {
+  MicroModule *mm;
+  MicroModuleEntry **entries;
+  const size_t *order;
+  int *results;
+  // Range of [order] to call, [next] is claimed by the workers
+  size_t begin;
+  size_t next;
+  size_t end;
+  void *arg;
+  // Call exit functions instead of init functions
+  bool exit;
+  // Whether all the modules may be called concurrently, otherwise only
+  // the independent ones are and the others are called in order
+  bool all;
+  // Set by the thread that calls the modules that are not independent
+  bool serial_taken;
+} _MicroModuleCalls;
+
+static void _micro_module_call(_MicroModuleCalls *calls, size_t i)
+{
+  MicroModuleEntry *entry = calls->entries[i];
+  if (!_micro_module_is_loaded(entry)) return;
+  if (calls->exit)
+    _micro_module_drain(entry);
+  _MICRO_MODULE_CLOCK(call_start);
+  calls->results[i] = calls->exit
+    ? entry->exit_fn(calls->arg)
+    : entry->init_fn(calls->arg);
+#ifdef MICRO_MODULE_STATS
+  // The entries of a batch being initialized are registered with their
+  // statistics once initialized
+  MicroModuleStats *stats = &entry->stats;
+  _micro_module_stats_record(calls->mm, stats, calls->exit
+                               ? MICRO_MODULE_PHASE_EXIT
+                               : MICRO_MODULE_PHASE_INIT, call_start);
+  if (calls->exit)
+    _micro_module_stats_count(calls->mm, stats,
+                              offsetof(MicroModuleStats, unloads));
+  else if (calls->results[i] == 0)
+    _micro_module_stats_count(calls->mm, stats,
+                              offsetof(MicroModuleStats, loads));
+#endif
+
+  // Register an initialized module right away, for the modules
+  // initialized after it to find it, and close a failed one
+  if (calls->exit) return;
+  if (calls->results[i] != 0)
+    _micro_module_close(calls->mm, entry);
+  else if ((calls->results[i] =
+            _micro_module_register(calls->mm, entry, calls->arg))
+           == MICRO_MODULE_OK)
+    _micro_module_retarget(calls->mm, entry->name, entry->dlhandler);
+}
+
+static void *_micro_module_calls_worker(void *ctx)
+{
+  _MicroModuleCalls *calls = ctx;
+
+  if (!calls->all
+      && !__atomic_exchange_n(&calls->serial_taken, true, __ATOMIC_RELAXED))
+  {
+    for (size_t k = calls->begin; k < calls->end; ++k)
+      if (!calls->entries[calls->order[k]]->independent)
+        _micro_module_call(calls, calls->order[k]);
+  }
+
+  size_t k;
+  while ((k = __atomic_fetch_add(&calls->next, 1, __ATOMIC_RELAXED))
+         < calls->end)
+  {
+    size_t i = calls->order[k];
+    if (calls->all || calls->entries[i]->independent)
+      _micro_module_call(calls, i);
+  }
+  return NULL;
+}
+
+// Calls the modules of [order] from [begin] to [end] on up to
+// [nthreads] threads
+static void _micro_module_run_calls(_MicroModuleCalls *calls,
+                                    size_t begin,
+                                    size_t end,
+                                    unsigned int nthreads)
+{
+  calls->begin        = begin;
+  calls->next         = begin;
+  calls->end          = end;
+  calls->serial_taken = false;
+  if (end - begin < nthreads)
+    nthreads = (unsigned int)(end - begin);
+  _micro_module_run_threads(nthreads, _micro_module_calls_worker, calls);
+}
+
+MICRO_MODULE_DEF MicroModule
+micro_module_setup(const char* name_symbol,
+                   const char* init_fn_symbol,
+                   const char* exit_fn_symbol,
+                   bool use_new_namespace)
+{
+  return (MicroModule) {
+    .name_symbol       = name_symbol,
+    .init_fn_symbol    = init_fn_symbol,
+    .exit_fn_symbol    = exit_fn_symbol,
+    .use_new_namespace = use_new_namespace,
+    .modules           = NULL,
+    .index             = NULL,
+    .check_files       = true,
+    .warm_up           = true,
+    .lock              = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP,
+    .epoch             = 1,
+    .async_lock        = PTHREAD_MUTEX_INITIALIZER,
+    .async_done        = PTHREAD_COND_INITIALIZER,
+#ifdef MICRO_MODULE_STATS
+    .stats_lock        = PTHREAD_MUTEX_INITIALIZER,
+#endif
+  };
+}
+
+MICRO_MODULE_DEF int
+micro_module_check(MicroModule *mm, const char* filename)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!filename) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  return _micro_module_check_file(mm, filename, NULL);
+}
+
+// Creates an empty memfd named [name] to be sealed with
+// _micro_module_memfd_seal, or returns -1
+static int _micro_module_memfd_create(const char *name)
+{
+  int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  // 0 means no memfd in MicroModuleEntry, keep away from it
+  if (fd == 0)
+  {
+    fd = fcntl(0, F_DUPFD_CLOEXEC, 1);
+    close(0);
+  }
+  return fd;
+}
+
+// Seals the memfd [fd], so nobody may change the image under the
+// loader, nor after it. Closes [fd] on failure.
+static bool _micro_module_memfd_seal(int fd)
+{
+  if (fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0)
+    return true;
+  close(fd);
+  return false;
+}
+
+// Copies the [size] bytes of the file open at [fd] into a new sealed
+// memfd named [name], which is returned, or -1
+static int _micro_module_shadow_copy(const char *name, int fd, size_t size)
+{
+  int memfd = _micro_module_memfd_create(name);
+  if (memfd < 0) return -1;
+  off_t offset = 0;
+  while ((size_t)offset < size)
+  {
+    ssize_t n = sendfile(memfd, fd, &offset, size - (size_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    // The file shrank while being copied, it is still being written
+    if (n <= 0)
+    {
+      close(memfd);
+      return -1;
+    }
+  }
+  return _micro_module_memfd_seal(memfd) ? memfd : -1;
+}
+
+// Opens the module in [filename] like _micro_module_open, or like
+// _micro_module_open_cached with [info] if it is not NULL. If
+// MicroModule.shadow_copy is set, it is opened through a shadow copy
+// of the file, as micro_module_init does, and keeps [filename] as its
+// path and the identity of the copied file.
+static int _micro_module_open_file(MicroModule *mm,
+                                   const char *filename,
+                                   const _MicroModuleElfInfo *info,
+                                   MicroModuleEntry *module)
+{
+  if (!mm->shadow_copy)
+    return info ? _micro_module_open_cached(mm, filename, info, module)
+                : _micro_module_open(mm, filename, module);
+
+  memset(module, 0, sizeof(*module));
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+  struct stat st;
+  MicroModuleFileId id = {0};
+  if (fstat(fd, &st) == 0)
+    _micro_module_file_id_from_stat(&st, &id);
+  // The manifest only holds for the file it was written for
+  if (id.ino == 0
+      || (info && !_micro_module_file_id_equal(&id, &info->file_id)))
+  {
+    close(fd);
+    return MICRO_MODULE_ERROR_OPENING_MODULE;
+  }
+  const char *name = strrchr(filename, '/');
+  int memfd = _micro_module_shadow_copy(name ? name + 1 : filename, fd,
+                                        (size_t)st.st_size);
+  close(fd);
+  if (memfd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+
+  char shadow_path[32];
+  snprintf(shadow_path, sizeof(shadow_path), "/proc/self/fd/%d", memfd);
+  int err = info ? _micro_module_open_cached(mm, shadow_path, info, module)
+                 : _micro_module_open(mm, shadow_path, module);
+  if (err != MICRO_MODULE_OK)
+  {
+    close(memfd);
+    return err;
+  }
+  module->memfd = memfd;
+  _micro_module_free(mm, module->path);
+  if (_micro_module_set_path(mm, module, filename) != MICRO_MODULE_OK)
+  {
+    module->path = NULL;
+    _micro_module_close(mm, module);
+    return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  }
+  // The build-id of the manifest still applies
+  if (!info) module->file_id = id;
+  return MICRO_MODULE_OK;
+}
+
+// Whether a module loaded from [path] still comes from the file of
+// identity [id], or from a file with the same build-id if it is known.
+// In the latter case, the identity of that module is updated to [id].
+static bool _micro_module_loaded_from(MicroModule *mm,
+                                      const char *path,
+                                      const MicroModuleFileId *id)
+{
+  bool found = false;
+  pthread_mutex_lock(&mm->lock);
+  for (MicroModuleList *it = mm->modules; it && !found; it = it->next)
+  {
+    if (!_micro_module_is_loaded(&it->module) || !it->module.path
+        || strcmp(it->module.path, path) != 0)
+      continue;
+    MicroModuleFileId *loaded = &it->module.file_id;
+    found = _micro_module_file_id_equal(loaded, id);
+    if (!found && id->build_id_length > 0
+        && loaded->build_id_length == id->build_id_length
+        && memcmp(loaded->build_id, id->build_id, id->build_id_length) == 0)
+    {
+      *loaded = *id;
+      found = true;
+    }
+  }
+  pthread_mutex_unlock(&mm->lock);
+  return found;
+}
+
+// Loads and initializes the module in [filename], see micro_module_init.
+// The module takes [memfd] if it is not 0, which is closed on failure.
+static int _micro_module_init_file(MicroModule *mm,
+                                   const char *filename,
+                                   int memfd,
+                                   void *arg)
+{
+  MicroModuleEntry module;
+  _MicroModuleElfInfo info;
+  const char *source = NULL;
+  struct stat source_stat;
+  char shadow_path[32];
+  if (mm->shadow_copy && memfd == 0)
+  {
+    // Copy from one descriptor, so that the file may be replaced
+    // meanwhile
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+    if (fstat(fd, &source_stat) != 0)
+    {
+      close(fd);
+      return MICRO_MODULE_ERROR_OPENING_MODULE;
+    }
+    MicroModuleFileId id = {0};
+    _micro_module_file_id_from_stat(&source_stat, &id);
+    if (mm->skip_unchanged && _micro_module_loaded_from(mm, filename, &id))
+    {
+      close(fd);
+      return MICRO_MODULE_OK;
+    }
+    const char *name = strrchr(filename, '/');
+    memfd = _micro_module_shadow_copy(name ? name + 1 : filename, fd,
+                                      (size_t)source_stat.st_size);
+    close(fd);
+    if (memfd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+    source = filename;
+    snprintf(shadow_path, sizeof(shadow_path), "/proc/self/fd/%d", memfd);
+    filename = shadow_path;
+  }
+
+  _MICRO_MODULE_CLOCK(check_start);
+  int err = MICRO_MODULE_OK;
+  bool has_id;
+  if (mm->check_files)
+  {
+    err = _micro_module_check_file(mm, filename, &info);
+    has_id = err == MICRO_MODULE_OK;
+  }
+  else
+  {
+    has_id = _micro_module_file_id(filename, &info.file_id);
+  }
+  _MICRO_MODULE_RECORD(mm, NULL, MICRO_MODULE_PHASE_CHECK, check_start);
+  // A snapshot is known by the file it was copied from, and its
+  // build-id, which may still match a loaded module
+  if (source && has_id)
+    _micro_module_file_id_from_stat(&source_stat, &info.file_id);
+
+  // Any other memfd is always a new file
+  if (err == MICRO_MODULE_OK && has_id && (memfd == 0 || source)
+      && mm->skip_unchanged
+      && _micro_module_loaded_from(mm, source ? source : filename,
+                                   &info.file_id))
+  {
+    if (source) close(memfd);
+    return MICRO_MODULE_OK;
+  }
+
+  if (err == MICRO_MODULE_OK)
+    err = _micro_module_open(mm, filename, &module);
+  if (err != MICRO_MODULE_OK)
+  {
+    if (memfd > 0) close(memfd);
+    return err;
+  }
+  module.memfd = memfd;
+  if (source)
+  {
+    // The snapshot is sealed, it cannot have changed since its check
+    _micro_module_free(mm, module.path);
+    if (_micro_module_set_path(mm, &module, source) != MICRO_MODULE_OK)
+    {
+      module.path = NULL;
+      _micro_module_close(mm, &module);
+      return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    }
+    if (has_id) module.file_id = info.file_id;
+  }
+  // Keep the build-id if the file did not change since its check
+  else if (has_id
+           && _micro_module_file_id_equal(&module.file_id, &info.file_id))
+  {
+    module.file_id = info.file_id;
+  }
+
+  for (const char *const *dep = module.deps; dep && *dep; ++dep)
+  {
+    if (strcmp(*dep, module.name) == 0 || !micro_module_get(mm, *dep))
+    {
+      _micro_module_close(mm, &module);
+      return MICRO_MODULE_ERROR_MISSING_DEPENDENCY;
+    }
+  }
+
+  if (mm->staged_reload
+      && _micro_module_reload_staged(mm, &module, arg, &err))
+    return err;
+
+  // Otherwise the old version is exited first, and the new one is
+  // registered once initialized
+  _micro_module_exit_replaced(mm, &module, arg);
+
+  // Call the function
+  _MICRO_MODULE_CLOCK(init_start);
+  err = module.init_fn(arg);
+  _MICRO_MODULE_RECORD(mm, &module.stats, MICRO_MODULE_PHASE_INIT,
+                       init_start);
+  if (err != 0)
+  {
+    _micro_module_close(mm, &module);
+    return err;
+  }
+  _MICRO_MODULE_COUNT(mm, &module.stats, loads);
+
+  err = _micro_module_register(mm, &module, arg);
+  if (err != MICRO_MODULE_OK) return err;
+  _micro_module_retarget(mm, module.name, module.dlhandler);
+  return MICRO_MODULE_OK;
+}
+
+MICRO_MODULE_DEF int
+micro_module_init(MicroModule *mm, char* filename, void* arg)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  return _micro_module_init_file(mm, filename, 0, arg);
+}
+
+// Copies the [len] bytes at [buf] into a new sealed memfd named
+// [name], which is returned, or -1
+static int _micro_module_memfd_image(const char *name,
+                                     const void *buf,
+                                     size_t len)
+{
+  int fd = _micro_module_memfd_create(name);
+  if (fd < 0) return -1;
+
+  const char *data = buf;
+  size_t written = 0;
+  while (written < len)
+  {
+    ssize_t n = write(fd, data + written, len - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0)
+    {
+      close(fd);
+      return -1;
+    }
+    written += (size_t)n;
+  }
+  return _micro_module_memfd_seal(fd) ? fd : -1;
+}
+
+MICRO_MODULE_DEF int
+micro_module_init_mem(MicroModule *mm,
+                      const char *name_hint,
+                      const void *buf,
+                      size_t len,
+                      void *arg)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!buf) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  int fd = _micro_module_memfd_image(name_hint ? name_hint : "micro-module",
+                                     buf, len);
+  if (fd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+
+  // The descriptor stays open while the module is loaded, so its path
+  // cannot name another file, which ld.so would take for this one
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return _micro_module_init_file(mm, path, fd, arg);
+}
+
+// Completes [load] with [result]: calls its callback, signals its
+// eventfd, and wakes up micro_module_load_wait, after which [load]
+// may be freed
+static void _micro_module_load_complete(MicroModuleLoad *load, int result)
+{
+  MicroModule *mm = load->mm;
+  load->result = result;
+  if (load->done_fn)
+    load->done_fn(load, result, load->done_arg);
+  uint64_t one = 1;
+  while (write(load->fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+  pthread_mutex_lock(&mm->async_lock);
+  load->state = MICRO_MODULE_LOAD_DONE;
+  pthread_cond_broadcast(&mm->async_done);
+  pthread_mutex_unlock(&mm->async_lock);
+}
+
+// Runs the queued loads of [ctx], a MicroModule, until there is none
+static void *_micro_module_async_worker(void *ctx)
+{
+  MicroModule *mm = ctx;
+  pthread_mutex_lock(&mm->async_lock);
+  while (mm->async_head)
+  {
+    MicroModuleLoad *load = mm->async_head;
+    mm->async_head = load->next;
+    if (!mm->async_head)
+      mm->async_tail = NULL;
+    load->state = MICRO_MODULE_LOAD_RUNNING;
+    pthread_mutex_unlock(&mm->async_lock);
+
+    _micro_module_load_complete(load,
+                                micro_module_init(mm, load->path, load->arg));
+    pthread_mutex_lock(&mm->async_lock);
+  }
+  mm->async_running = false;
+  pthread_mutex_unlock(&mm->async_lock);
+  return NULL;
+}
+
+// Cancels the queued loads and waits for the worker to exit, unless
+// called from the worker itself
+static void _micro_module_async_stop(MicroModule *mm)
+{
+  pthread_mutex_lock(&mm->async_lock);
+  MicroModuleLoad *queued = mm->async_head;
+  mm->async_head = NULL;
+  mm->async_tail = NULL;
+  for (MicroModuleLoad *it = queued; it; it = it->next)
+    it->state = MICRO_MODULE_LOAD_RUNNING;
+  bool join = mm->async_joinable
+    && !pthread_equal(mm->async_thread, pthread_self());
+  if (join)
+    mm->async_joinable = false;
+  pthread_mutex_unlock(&mm->async_lock);
+
+  while (queued)
+  {
+    MicroModuleLoad *next = queued->next;
+    _micro_module_load_complete(queued, MICRO_MODULE_ERROR_CANCELED);
+    queued = next;
+  }
+  if (join)
+    pthread_join(mm->async_thread, NULL);
+}
+
+MICRO_MODULE_DEF MicroModuleLoad*
+micro_module_init_async(MicroModule *mm,
+                        const char *filename,
+                        void *arg,
+                        micro_module_load_fn done_fn,
+                        void *done_arg)
+{
+  if (!mm || !filename) return NULL;
+
+  // The path is stored after the load
+  size_t length = strlen(filename) + 1;
+  MicroModuleLoad *load = _micro_module_alloc(mm, sizeof(*load) + length);
+  if (!load) return NULL;
+  memset(load, 0, sizeof(*load));
+  load->mm       = mm;
+  load->path     = (char*)(load + 1);
+  load->arg      = arg;
+  load->done_fn  = done_fn;
+  load->done_arg = done_arg;
+  load->state    = MICRO_MODULE_LOAD_QUEUED;
+  memcpy(load->path, filename, length);
+  load->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (load->fd < 0)
+  {
+    _micro_module_free(mm, load);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mm->async_lock);
+  if (!mm->async_running)
+  {
+    // The previous worker is done with the lock, it is about to exit
+    if (mm->async_joinable)
+      pthread_join(mm->async_thread, NULL);
+    mm->async_joinable = false;
+    if (pthread_create(&mm->async_thread, NULL,
+                       _micro_module_async_worker, mm) != 0)
+    {
+      pthread_mutex_unlock(&mm->async_lock);
+      close(load->fd);
+      _micro_module_free(mm, load);
+      return NULL;
+    }
+    mm->async_running  = true;
+    mm->async_joinable = true;
+  }
+  if (mm->async_tail)
+    mm->async_tail->next = load;
+  else
+    mm->async_head = load;
+  mm->async_tail = load;
+  pthread_mutex_unlock(&mm->async_lock);
+  return load;
+}
+
+MICRO_MODULE_DEF bool micro_module_load_cancel(MicroModuleLoad *load)
+{
+  if (!load) return false;
+  MicroModule *mm = load->mm;
+  pthread_mutex_lock(&mm->async_lock);
+  if (load->state != MICRO_MODULE_LOAD_QUEUED)
+  {
+    pthread_mutex_unlock(&mm->async_lock);
+    return false;
+  }
+  MicroModuleLoad *prev = NULL;
+  for (MicroModuleLoad *it = mm->async_head; it != load; it = it->next)
+    prev = it;
+  if (prev)
+    prev->next = load->next;
+  else
+    mm->async_head = load->next;
+  if (mm->async_tail == load)
+    mm->async_tail = prev;
+  load->state = MICRO_MODULE_LOAD_RUNNING;
+  pthread_mutex_unlock(&mm->async_lock);
+
+  _micro_module_load_complete(load, MICRO_MODULE_ERROR_CANCELED);
+  return true;
+}
+
+MICRO_MODULE_DEF int micro_module_load_wait(MicroModuleLoad *load)
+{
+  if (!load) return MICRO_MODULE_ERROR_IS_NULL;
+  MicroModule *mm = load->mm;
+  pthread_mutex_lock(&mm->async_lock);
+  while (load->state != MICRO_MODULE_LOAD_DONE)
+    pthread_cond_wait(&mm->async_done, &mm->async_lock);
+  pthread_mutex_unlock(&mm->async_lock);
+  return load->result;
+}
+
+MICRO_MODULE_DEF void micro_module_load_free(MicroModuleLoad *load)
+{
+  if (!load) return;
+  micro_module_load_wait(load);
+  close(load->fd);
+  _micro_module_free(load->mm, load);
+}
+
+static uint64_t _micro_module_hash64(uint64_t hash,
+                                     const void *data,
+                                     size_t size)
+{
+  const unsigned char *it = data;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= it[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+#define _MICRO_MODULE_HASH64_INIT 14695981039346656037ull
+
+// Checks the header, the index and the names of the bundle mapped at
+// [map], of [size] bytes, and returns its index, or NULL
+static const MicroModuleBundleIndex *
+_micro_module_bundle_index(const unsigned char *map,
+                           size_t size,
+                           const MicroModuleBundleHeader **header)
+{
+  const MicroModuleBundleHeader *h = (const MicroModuleBundleHeader*)map;
+  if (size < sizeof(*h)
+      || memcmp(h->magic, MICRO_MODULE_BUNDLE_MAGIC, sizeof(h->magic)) != 0
+      || h->version != MICRO_MODULE_BUNDLE_VERSION
+      || h->count > (size - sizeof(*h)) / sizeof(MicroModuleBundleIndex)
+      || h->names_offset > size || h->names_size > size - h->names_offset)
+    return NULL;
+
+  const MicroModuleBundleIndex *index =
+    (const MicroModuleBundleIndex*)(map + sizeof(*h));
+  const char *names = (const char*)map + h->names_offset;
+  for (uint32_t i = 0; i < h->count; ++i)
+  {
+    const MicroModuleBundleIndex *it = &index[i];
+    if (it->offset > size || it->size > size - it->offset
+        || it->name_offset >= h->names_size
+        || it->name_length >= h->names_size - it->name_offset
+        || names[it->name_offset + it->name_length] != '\0')
+      return NULL;
+  }
+  *header = h;
+  return index;
+}
+
+MICRO_MODULE_DEF int
+micro_module_init_bundle(MicroModule *mm, const char *path, void *arg)
+{
+  return micro_module_init_bundle_modules(mm, path, NULL, arg);
+}
+
+// Progress of a module of a bundle in micro_module_init_bundle_modules
+#define _MICRO_MODULE_BUNDLE_SKIP    0
+#define _MICRO_MODULE_BUNDLE_PENDING 1
+#define _MICRO_MODULE_BUNDLE_DONE    2
+
+MICRO_MODULE_DEF int
+micro_module_init_bundle_modules(MicroModule *mm,
+                                 const char *path,
+                                 const char *const *names,
+                                 void *arg)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!path) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return MICRO_MODULE_ERROR_OPENING_MODULE;
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return MICRO_MODULE_ERROR_OPENING_MODULE;
+  }
+  if ((size_t)st.st_size < sizeof(MicroModuleBundleHeader))
+  {
+    close(fd);
+    return MICRO_MODULE_ERROR_BAD_BUNDLE;
+  }
+  size_t size = (size_t)st.st_size;
+  const unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return MICRO_MODULE_ERROR_OPENING_MODULE;
+  if (mm->warm_up)
+  {
+    _MICRO_MODULE_CLOCK(warm_up_start);
+    madvise((void*)map, size, MADV_WILLNEED);
+    _MICRO_MODULE_RECORD(mm, NULL, MICRO_MODULE_PHASE_WARM_UP, warm_up_start);
+  }
+
+  const MicroModuleBundleHeader *header;
+  const MicroModuleBundleIndex *index =
+    _micro_module_bundle_index(map, size, &header);
+  unsigned char *states = NULL;
+  int *memfds = NULL;
+  int err = MICRO_MODULE_OK;
+  if (!index)
+    err = MICRO_MODULE_ERROR_BAD_BUNDLE;
+  else if (!(states = _micro_module_alloc(mm, header->count + 1))
+           || !(memfds = _micro_module_alloc(mm, (header->count + 1)
+                                                 * sizeof(int))))
+    err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  if (err != MICRO_MODULE_OK) goto exit;
+
+  const char *bundle_names = (const char*)map + header->names_offset;
+  memset(states, names ? _MICRO_MODULE_BUNDLE_SKIP
+                       : _MICRO_MODULE_BUNDLE_PENDING, header->count);
+  for (uint32_t i = 0; i < header->count; ++i)
+    memfds[i] = -1;
+  for (const char *const *name = names; name && *name; ++name)
+  {
+    uint32_t i = 0;
+    while (i < header->count
+           && strcmp(bundle_names + index[i].name_offset, *name) != 0)
+      ++i;
+    if (i == header->count)
+    {
+      err = MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED;
+      goto exit;
+    }
+    states[i] = _MICRO_MODULE_BUNDLE_PENDING;
+  }
+
+  // Each pass loads what it can, until a pass makes no progress
+  bool progress = true, pending = true;
+  while (progress && pending)
+  {
+    progress = pending = false;
+    for (uint32_t i = 0; i < header->count; ++i)
+    {
+      if (states[i] != _MICRO_MODULE_BUNDLE_PENDING) continue;
+
+      // Each image is checked and copied once, however many passes
+      // it waits for its dependencies
+      if (memfds[i] < 0)
+      {
+        const unsigned char *image = map + index[i].offset;
+        if (_micro_module_hash64(_MICRO_MODULE_HASH64_INIT, image,
+                                 index[i].size) != index[i].hash)
+        {
+          err = MICRO_MODULE_ERROR_BAD_BUNDLE;
+          goto exit;
+        }
+        memfds[i] = _micro_module_memfd_image(bundle_names
+                                              + index[i].name_offset,
+                                              image, index[i].size);
+        if (memfds[i] < 0)
+        {
+          err = MICRO_MODULE_ERROR_OPENING_MODULE;
+          goto exit;
+        }
+      }
+
+      // The module owns a descriptor of its own, closed with it
+      int memfd = fcntl(memfds[i], F_DUPFD_CLOEXEC, 1);
+      if (memfd < 0)
+      {
+        err = MICRO_MODULE_ERROR_OPENING_MODULE;
+        goto exit;
+      }
+      char memfd_path[32];
+      snprintf(memfd_path, sizeof(memfd_path), "/proc/self/fd/%d", memfd);
+      err = _micro_module_init_file(mm, memfd_path, memfd, arg);
+      if (err == MICRO_MODULE_ERROR_MISSING_DEPENDENCY)
+      {
+        pending = true;
+        continue;
+      }
+      if (err != MICRO_MODULE_OK) goto exit;
+      states[i] = _MICRO_MODULE_BUNDLE_DONE;
+      progress = true;
+    }
+  }
+  err = pending ? MICRO_MODULE_ERROR_MISSING_DEPENDENCY : MICRO_MODULE_OK;
+
+ exit:
+  for (uint32_t i = 0; memfds && i < header->count; ++i)
+    if (memfds[i] >= 0) close(memfds[i]);
+  _micro_module_free(mm, memfds);
+  _micro_module_free(mm, states);
+  munmap((void*)map, size);
+  return err;
+}
+
+// Writes the [size] bytes of [data] at [offset] of [fd]
+static bool _micro_module_pwrite(int fd,
+                                 const void *data,
+                                 size_t size,
+                                 uint64_t offset)
+{
+  const char *it = data;
+  while (size > 0)
+  {
+    ssize_t n = pwrite(fd, it, size, (off_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    it     += n;
+    size   -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+  return true;
+}
+
+// Copies [file] to [offset] of [fd], returning its hash in [hash]
+static bool _micro_module_bundle_copy(int fd,
+                                      const char *file,
+                                      uint64_t size,
+                                      uint64_t offset,
+                                      uint64_t *hash)
+{
+  int in = open(file, O_RDONLY | O_CLOEXEC);
+  if (in < 0) return false;
+  char buffer[65536];
+  *hash = _MICRO_MODULE_HASH64_INIT;
+  uint64_t copied = 0;
+  while (copied < size)
+  {
+    ssize_t n = read(in, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0 || (uint64_t)n > size - copied
+        || !_micro_module_pwrite(fd, buffer, (size_t)n, offset + copied))
+      break;
+    *hash = _micro_module_hash64(*hash, buffer, (size_t)n);
+    copied += (uint64_t)n;
+  }
+  close(in);
+  return copied == size;
+}
+
+MICRO_MODULE_DEF int
+micro_module_write_bundle(MicroModule *mm,
+                          const char *path,
+                          const char *const *files,
+                          size_t count)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!path || (!files && count > 0)) return MICRO_MODULE_ERROR_ARG_NULL;
+  if (count > UINT32_MAX) return MICRO_MODULE_ERROR_BAD_BUNDLE;
+
+  // The names are kept after the index, ready to be written with it
+  size_t index_size = count * sizeof(MicroModuleBundleIndex);
+  size_t names_capacity = count * 64 + 1;
+  unsigned char *head =
+    _micro_module_alloc(mm, sizeof(MicroModuleBundleHeader) + index_size
+                        + names_capacity);
+  if (!head) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  MicroModuleBundleHeader *header = (MicroModuleBundleHeader*)head;
+  MicroModuleBundleIndex *index =
+    (MicroModuleBundleIndex*)(head + sizeof(*header));
+  memset(head, 0, sizeof(*header) + index_size);
+  memcpy(header->magic, MICRO_MODULE_BUNDLE_MAGIC, sizeof(header->magic));
+  header->version = MICRO_MODULE_BUNDLE_VERSION;
+  header->count   = (uint32_t)count;
+  header->names_offset = sizeof(*header) + index_size;
+
+  int err = MICRO_MODULE_OK;
+  _MicroModuleElfInfo info;
+  for (size_t i = 0; i < count && err == MICRO_MODULE_OK; ++i)
+  {
+    err = _micro_module_check_file(mm, files[i], &info);
+    if (err != MICRO_MODULE_OK) break;
+    size_t length = strlen(info.name);
+    if (length == 0)
+    {
+      err = MICRO_MODULE_ERROR_LOCATING_NAME_SYMBOL;
+      break;
+    }
+    char *names = (char*)head + header->names_offset;
+    for (size_t j = 0; j < i && err == MICRO_MODULE_OK; ++j)
+      if (strcmp(names + index[j].name_offset, info.name) == 0)
+        err = MICRO_MODULE_ERROR_BAD_BUNDLE;
+    if (err == MICRO_MODULE_OK
+        && header->names_size + length + 1 > names_capacity)
+    {
+      size_t capacity = names_capacity * 2 + length + 1;
+      unsigned char *bigger =
+        _micro_module_alloc(mm, header->names_offset + capacity);
+      if (!bigger)
+      {
+        err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+        break;
+      }
+      memcpy(bigger, head, header->names_offset + header->names_size);
+      _micro_module_free(mm, head);
+      head   = bigger;
+      header = (MicroModuleBundleHeader*)head;
+      index  = (MicroModuleBundleIndex*)(head + sizeof(*header));
+      names  = (char*)head + header->names_offset;
+      names_capacity = capacity;
+    }
+    if (err != MICRO_MODULE_OK) break;
+    memcpy(names + header->names_size, info.name, length + 1);
+    index[i].name_offset = header->names_size;
+    index[i].name_length = length;
+    index[i].size        = info.file_id.size;
+    header->names_size  += length + 1;
+  }
+
+  // Place the images
+  uint64_t offset = header->names_offset + header->names_size;
+  for (size_t i = 0; i < count && err == MICRO_MODULE_OK; ++i)
+  {
+    offset = (offset + MICRO_MODULE_BUNDLE_ALIGN - 1)
+      / MICRO_MODULE_BUNDLE_ALIGN * MICRO_MODULE_BUNDLE_ALIGN;
+    index[i].offset = offset;
+    offset += index[i].size;
+  }
+
+  size_t length = strlen(path);
+  char *tmp_path = NULL;
+  if (err == MICRO_MODULE_OK
+      && !(tmp_path = _micro_module_alloc(mm, length + sizeof(".tmp"))))
+    err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  if (err != MICRO_MODULE_OK)
+  {
+    _micro_module_free(mm, head);
+    return err;
+  }
+  memcpy(tmp_path, path, length);
+  memcpy(tmp_path + length, ".tmp", sizeof(".tmp"));
+
+  // The images first, the index once their hashes are known
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool ok = fd >= 0 && ftruncate(fd, (off_t)offset) == 0;
+  for (size_t i = 0; i < count && ok; ++i)
+    ok = _micro_module_bundle_copy(fd, files[i], index[i].size,
+                                   index[i].offset, &index[i].hash);
+  ok = ok && _micro_module_pwrite(fd, head, header->names_offset
+                                  + header->names_size, 0);
+  if (fd >= 0)
+    ok = (close(fd) == 0) && ok;
+  if (!ok || rename(tmp_path, path) != 0)
+  {
+    unlink(tmp_path);
+    err = MICRO_MODULE_ERROR_BAD_BUNDLE;
+  }
+  _micro_module_free(mm, tmp_path);
+  _micro_module_free(mm, head);
+  return err;
+}
+
+MICRO_MODULE_DEF int
+micro_module_init_all(MicroModule *mm, char *modules_dir, void* arg)
+{
+  return micro_module_init_all_parallel(mm, modules_dir, arg, 1);
+}
+
+// Closes the module of [item], which is not registered, without
+// exiting it
+static void _micro_module_batch_drop(MicroModule *mm,
+                                     _MicroModuleBatchItem *item)
+{
+  _micro_module_close(mm, &item->module);
+  item->err = MICRO_MODULE_ERROR_OPENING_MODULE;
+}
+
+MICRO_MODULE_DEF int
+micro_module_init_all_parallel(MicroModule *mm,
+                               char* modules_dir,
+                               void* arg,
+                               unsigned int nthreads)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+
+  if (nthreads == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = cpus > 0 ? (unsigned int)cpus : 1;
+  }
+
+  _MicroModuleBatch batch = { .mm = mm, .arg = arg, .changed = true };
+  size_t *order = NULL;
+  int err = MICRO_MODULE_OK;
+  bool use_manifest = mm->manifest_path
+    && _micro_module_file_id(modules_dir, &batch.dir_id);
+  if (use_manifest && _micro_module_manifest_read(&batch, modules_dir))
+    batch.changed = false;
+  else
+    err = _micro_module_batch_scan(&batch, modules_dir);
+  if (err != MICRO_MODULE_OK) goto exit;
+
+  // Start reading all the files before opening any, the reads of each
+  // file then overlap with the opening of the previous ones
+  unsigned int batch_threads = nthreads < batch.count
+    ? nthreads : (unsigned int)batch.count;
+  if (mm->warm_up && batch.count > 0)
+  {
+    _MICRO_MODULE_CLOCK(warm_up_start);
+    _micro_module_run_threads(batch_threads,
+                              _micro_module_batch_warm_up_worker, &batch);
+    _MICRO_MODULE_RECORD(mm, NULL, MICRO_MODULE_PHASE_WARM_UP,
+                         warm_up_start);
+  }
+
+  // Prefetch and open the files
+  _micro_module_run_threads(batch_threads,
+                            _micro_module_batch_load_worker, &batch);
+  err = _micro_module_batch_skip_rejected(&batch);
+  if (err != MICRO_MODULE_OK)
+  {
+    for (size_t i = 0; i < batch.count; ++i)
+      if (batch.items[i].err == MICRO_MODULE_OK)
+        _micro_module_batch_drop(mm, &batch.items[i]);
+    goto exit;
+  }
+
+  // Keep the files up to the first failure
+  size_t loaded = 0;
+  while (loaded < batch.count && batch.items[loaded].err == MICRO_MODULE_OK)
+    loaded++;
+  if (loaded < batch.count)
+    err = batch.items[loaded].err;
+  for (size_t i = loaded + 1; i < batch.count; ++i)
+    if (batch.items[i].err == MICRO_MODULE_OK)
+      _micro_module_batch_drop(mm, &batch.items[i]);
+  if (loaded == 0) goto exit;
+
+  // Schedule them by their dependencies
+  order = _micro_module_alloc(mm, loaded * (sizeof(MicroModuleEntry*)
+                                            + sizeof(size_t) * 2 + sizeof(int)));
+  if (!order)
+  {
+    err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    for (size_t i = 0; i < loaded; ++i)
+      _micro_module_batch_drop(mm, &batch.items[i]);
+    goto exit;
+  }
+  MicroModuleEntry **entries = (MicroModuleEntry**)(order + loaded);
+  size_t *levels = (size_t*)(entries + loaded);
+  int *results = (int*)(levels + loaded);
+  for (size_t i = 0; i < loaded; ++i)
+  {
+    entries[i] = &batch.items[i].module;
+    results[i] = 0;
+  }
+
+  size_t scheduled;
+  int schedule_err = _micro_module_schedule(mm, entries, loaded, true,
+                                            order, levels, &scheduled);
+  for (size_t i = 0; i < loaded; ++i)
+  {
+    if (schedule_err != MICRO_MODULE_OK || levels[i] == _MICRO_MODULE_SUPERSEDED)
+      _micro_module_batch_drop(mm, &batch.items[i]);
+  }
+  if (schedule_err != MICRO_MODULE_OK)
+  {
+    err = schedule_err;
+    goto exit;
+  }
+
+  // Exit the versions they replace in directory order, the new ones
+  // are registered once initialized
+  for (size_t i = 0; i < loaded; ++i)
+    if (batch.items[i].err == MICRO_MODULE_OK)
+      _micro_module_exit_replaced(mm, &batch.items[i].module, arg);
+
+  // Initialize them level by level. With MicroModule.deps_symbol, the
+  // levels already order the modules after their dependencies, so all
+  // the modules of a level are initialized concurrently. Without it,
+  // only the independent modules are, the others are initialized one
+  // after the other in directory order.
+  _MicroModuleCalls calls = {
+    .mm      = mm,
+    .entries = entries,
+    .order   = order,
+    .results = results,
+    .arg     = arg,
+    .exit    = false,
+    .all     = mm->deps_symbol != NULL || nthreads == 1,
+  };
+  size_t begin = 0;
+  while (begin < scheduled)
+  {
+    size_t end = begin + 1;
+    while (end < scheduled && levels[order[end]] == levels[order[begin]])
+      end++;
+    _micro_module_run_calls(&calls, begin, end, nthreads);
+
+    // The modules that failed were closed
+    int init_err = 0;
+    for (size_t k = begin; k < end; ++k)
+    {
+      _MicroModuleBatchItem *item = &batch.items[order[k]];
+      item->registered = results[order[k]] == 0;
+      if (!item->registered && init_err == 0)
+        init_err = results[order[k]];
+    }
+    if (init_err != 0)
+    {
+      // Do not initialize the modules depending on a failed one
+      for (size_t k = end; k < scheduled; ++k)
+        _micro_module_batch_drop(mm, &batch.items[order[k]]);
+      if (err == MICRO_MODULE_OK)
+        err = init_err;
+      break;
+    }
+    begin = end;
+  }
+
+  if (err == MICRO_MODULE_OK && use_manifest && batch.changed)
+    _micro_module_manifest_write(&batch, modules_dir);
+
+ exit:
+  _micro_module_free(mm, order);
+  _micro_module_batch_free(&batch);
+  return err;
+}
+
+// micro_module_init_lazy, setting [rejected] if the file failed the
+// checks of MicroModule.check_files
+static int _micro_module_init_lazy(MicroModule *mm,
+                                   char* filename,
+                                   const char* module_name,
+                                   void* arg,
+                                   bool *rejected)
+{
+  *rejected = false;
+
+  // Read the name from the file when checking it
+  _MicroModuleElfInfo info;
+  if (mm->check_files)
+  {
+    int err = _micro_module_check_file(mm, filename, &info);
+    *rejected = err != MICRO_MODULE_OK
+      && err != MICRO_MODULE_ERROR_OPENING_MODULE;
+    if (err != MICRO_MODULE_OK) return err;
+    if (!module_name && info.name[0] != '\0')
+      module_name = info.name;
+  }
+
+  size_t path_length = strlen(filename) + 1;
+  size_t name_length;
+  if (module_name)
+  {
+    name_length = strlen(module_name);
+  }
+  else
+  {
+    const char *base = strrchr(filename, '/');
+    module_name = base ? base + 1 : filename;
+    name_length = strcspn(module_name, ".");
+  }
+
+  // The name is stored after the path
+  MicroModuleEntry module;
+  memset(&module, 0, sizeof(module));
+  module.path = _micro_module_alloc(mm, path_length + name_length + 1);
+  if (!module.path) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  memcpy(module.path, filename, path_length);
+  module.name = module.path + path_length;
+  memcpy(module.name, module_name, name_length);
+  module.name[name_length] = '\0';
+  module.state    = MICRO_MODULE_STATE_LAZY;
+  module.init_arg = arg;
+
+  // Loading it may open the very instance of the module it replaces,
+  // which must be exited by then
+  _micro_module_exit_replaced(mm, &module, arg);
+  return _micro_module_register(mm, &module, arg);
+}
+
+MICRO_MODULE_DEF int
+micro_module_init_lazy(MicroModule *mm,
+                       char* filename,
+                       const char* module_name,
+                       void* arg)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!filename) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  bool rejected;
+  return _micro_module_init_lazy(mm, filename, module_name, arg, &rejected);
+}
+
+MICRO_MODULE_DEF int
+micro_module_init_all_lazy(MicroModule *mm, char* modules_dir, void* arg)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+
+  _MicroModuleBatch batch = { .mm = mm, .arg = arg };
+  int err = _micro_module_batch_scan(&batch, modules_dir);
+  for (size_t i = 0; i < batch.count && err == MICRO_MODULE_OK; ++i)
+  {
+    _MicroModuleBatchItem *item = &batch.items[i];
+    err = _micro_module_init_lazy(mm, item->path, NULL, arg, &item->rejected);
+    if (item->rejected)
+    {
+      if (mm->skip_fn)
+        mm->skip_fn(item->path, err, mm->skip_arg);
+      err = MICRO_MODULE_OK;
+    }
+  }
+
+  _micro_module_batch_free(&batch);
+  return err;
+}
+
+static MicroModuleEntry *_micro_module_get(MicroModule *mm,
+                                           const char *module_name,
+                                           MicroModuleList *loading,
+                                           bool *cycle);
+
+// Opens and initializes the lazy module of [node], which the calling
+// thread marked MICRO_MODULE_STATE_LOADING, without holding
+// MicroModule.lock
+static int _micro_module_load_lazy(MicroModule *mm, MicroModuleList *node)
+{
+  MicroModuleEntry *module = &node->module;
+  MicroModuleEntry loaded;
+  int err = _micro_module_open_file(mm, module->path, NULL, &loaded);
+  if (err != MICRO_MODULE_OK) return err;
+
+  if (strcmp(loaded.name, module->name) != 0)
+  {
+    _micro_module_close(mm, &loaded);
+    return MICRO_MODULE_ERROR_NAME_MISMATCH;
+  }
+
+  // Dependencies get loaded first, waiting for one being loaded by a
+  // thread that waits for this one means they form a cycle
+  for (const char *const *dep = loaded.deps; dep && *dep; ++dep)
+  {
+    bool cycle = false;
+    if (!_micro_module_get(mm, *dep, node, &cycle))
+    {
+      _micro_module_close(mm, &loaded);
+      return cycle ? MICRO_MODULE_ERROR_DEPENDENCY_CYCLE
+                   : MICRO_MODULE_ERROR_MISSING_DEPENDENCY;
+    }
+  }
+
+  _MICRO_MODULE_CLOCK(init_start);
+  err = loaded.init_fn(module->init_arg);
+  _MICRO_MODULE_RECORD(mm, &loaded.stats, MICRO_MODULE_PHASE_INIT,
+                       init_start);
+#ifdef MICRO_MODULE_STATS
+  pthread_mutex_lock(&mm->stats_lock);
+  _micro_module_stats_merge(&module->stats, &loaded.stats);
+  pthread_mutex_unlock(&mm->stats_lock);
+#endif
+  if (err != 0)
+  {
+    _micro_module_close(mm, &loaded);
+    return err;
+  }
+  _MICRO_MODULE_COUNT(mm, &module->stats, loads);
+
+  // Keep the name and path that were registered
+  _micro_module_free(mm, loaded.path);
+  module->init_fn     = loaded.init_fn;
+  module->exit_fn     = loaded.exit_fn;
+  module->dlhandler   = loaded.dlhandler;
+  module->independent = loaded.independent;
+  module->deps        = loaded.deps;
+  module->file_id     = loaded.file_id;
+  module->memfd       = loaded.memfd;
+  module->fns         = loaded.fns;
+  module->refs        = loaded.refs;
+  return MICRO_MODULE_OK;
+}
+
+// micro_module_get, for the thread loading the lazy module of
+// [loading] if it is not NULL. [cycle] is set if the module is being
+// loaded by a thread that waits, directly or not, for [loading].
+static MicroModuleEntry *_micro_module_get(MicroModule *mm,
+                                           const char *module_name,
+                                           MicroModuleList *loading,
+                                           bool *cycle)
+{
+  size_t length;
+  uint32_t hash = _micro_module_hash(module_name, &length);
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(__atomic_load_n(&mm->index, __ATOMIC_ACQUIRE),
+                             module_name, hash, length);
+  if (!slot) return NULL;
+
+  // The module may have been removed since it was found
+  MicroModuleList *node = __atomic_load_n(&slot->node, __ATOMIC_ACQUIRE);
+  if (node == _MICRO_MODULE_TOMBSTONE) return NULL;
+  MicroModuleEntry *module = &node->module;
+  if (_micro_module_is_loaded(module)) return module;
+
+  pthread_mutex_lock(&mm->lock);
+  // A node replaced or removed meanwhile must not be loaded, nothing
+  // would exit it
+  slot = _micro_module_index_find(mm->index, module_name, hash, length);
+  if (!slot || slot->node != node)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return _micro_module_get(mm, module_name, loading, cycle);
+  }
+  if (module->state == MICRO_MODULE_STATE_LAZY)
+  {
+    // Load it without holding the lock, which dlmopen and the init
+    // function may need on other threads
+    node->loader  = pthread_self();
+    node->waiting = NULL;
+    __atomic_store_n(&module->state, MICRO_MODULE_STATE_LOADING,
+                     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mm->lock);
+    int err = _micro_module_load_lazy(mm, node);
+    pthread_mutex_lock(&mm->lock);
+    int state = err == MICRO_MODULE_OK
+      ? MICRO_MODULE_STATE_LOADED : MICRO_MODULE_STATE_FAILED;
+    __atomic_store_n(&module->state, state, __ATOMIC_RELEASE);
+    if (state == MICRO_MODULE_STATE_LOADED)
+      _micro_module_retarget(mm, module->name, module->dlhandler);
+    pthread_cond_broadcast(&node->loaded);
+  }
+  else if (module->state == MICRO_MODULE_STATE_LOADING)
+  {
+    // The thread loading it may be this one, or wait for this one
+    for (MicroModuleList *it = node;
+         loading && it && it->module.state == MICRO_MODULE_STATE_LOADING;
+         it = it->waiting)
+    {
+      if (it == loading || pthread_equal(it->loader, pthread_self()))
+      {
+        *cycle = true;
+        break;
+      }
+    }
+    if (!*cycle)
+    {
+      if (loading) loading->waiting = node;
+      _micro_module_wait_loading(mm, node);
+      if (loading) loading->waiting = NULL;
+    }
+  }
+  pthread_mutex_unlock(&mm->lock);
+
+  return _micro_module_is_loaded(module) ? module : NULL;
+}
+
+MICRO_MODULE_DEF MicroModuleEntry*
+micro_module_get(MicroModule *mm, const char *module_name)
+{
+  if (!mm || !module_name) return NULL;
+  bool cycle = false;
+  return _micro_module_get(mm, module_name, NULL, &cycle);
+}
+
+// Looks [symbol] up in [cache]. Returns its slot, or NULL if it was
+// not cached.
+static MicroModuleSymSlot *_micro_module_sym_find(MicroModuleSymCache *cache,
+                                                  const char *symbol,
+                                                  uint32_t hash)
+{
+  if (!cache) return NULL;
+  size_t mask = cache->capacity - 1;
+  for (size_t i = hash & mask; ; i = (i + 1) & mask)
+  {
+    MicroModuleSymSlot *slot = &cache->slots[i];
+    char *name = __atomic_load_n(&slot->symbol, __ATOMIC_ACQUIRE);
+    if (!name) return NULL;
+    if (slot->hash == hash && strcmp(name, symbol) == 0) return slot;
+  }
+}
+
+// Returns a cache like [cache] with room for one more symbol. Returns
+// [cache] itself if it has room, or NULL if memory ran out.
+static MicroModuleSymCache *_micro_module_sym_reserve(MicroModule *mm,
+                                                     MicroModuleSymCache *cache)
+{
+  // Keep the load factor under 3/4
+  if (cache && (cache->count + 1) * 4 <= cache->capacity * 3) return cache;
+
+  size_t capacity = cache ? cache->capacity * 2 : MICRO_MODULE_SYM_CAPACITY;
+  MicroModuleSymCache *bigger =
+    _micro_module_alloc(mm, sizeof(MicroModuleSymCache)
+                            + capacity * sizeof(MicroModuleSymSlot));
+  if (!bigger) return NULL;
+  bigger->capacity = capacity;
+  bigger->count    = cache ? cache->count : 0;
+  bigger->slots    = (MicroModuleSymSlot*)(bigger + 1);
+  bigger->retired  = cache;
+  memset(bigger->slots, 0, capacity * sizeof(MicroModuleSymSlot));
+
+  for (size_t i = 0; cache && i < cache->capacity; ++i)
+  {
+    MicroModuleSymSlot *slot = &cache->slots[i];
+    if (!slot->symbol) continue;
+    size_t j = slot->hash & (capacity - 1);
+    while (bigger->slots[j].symbol)
+      j = (j + 1) & (capacity - 1);
+    bigger->slots[j] = *slot;
+  }
+  return bigger;
+}
+
+MICRO_MODULE_DEF void*
+micro_module_sym(MicroModule *mm,
+                 MicroModuleEntry *module,
+                 const char *symbol)
+{
+  if (!mm || !module || !symbol) return NULL;
+  if (!_micro_module_is_loaded(module)) return NULL;
+
+  size_t length;
+  uint32_t hash = _micro_module_hash(symbol, &length);
+  MicroModuleSymSlot *slot =
+    _micro_module_sym_find(__atomic_load_n(&module->syms, __ATOMIC_ACQUIRE),
+                           symbol, hash);
+  if (slot) return slot->address;
+
+  // Resolve it outside of the lock, dlsym takes its own
+  void *address = dlsym(module->dlhandler, symbol);
+
+  pthread_mutex_lock(&mm->lock);
+  if (_micro_module_sym_find(module->syms, symbol, hash))
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return address;
+  }
+
+  char *name = _micro_module_alloc(mm, length + 1);
+  MicroModuleSymCache *cache = _micro_module_sym_reserve(mm, module->syms);
+  if (!name || !cache)
+  {
+    // Still answer, just without caching
+    _micro_module_free(mm, name);
+    pthread_mutex_unlock(&mm->lock);
+    return address;
+  }
+  memcpy(name, symbol, length + 1);
+
+  size_t mask = cache->capacity - 1;
+  size_t i = hash & mask;
+  while (cache->slots[i].symbol)
+    i = (i + 1) & mask;
+  cache->slots[i].hash    = hash;
+  cache->slots[i].address = address;
+  __atomic_store_n(&cache->slots[i].symbol, name, __ATOMIC_RELEASE);
+  cache->count++;
+  if (cache != module->syms)
+    __atomic_store_n(&module->syms, cache, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&mm->lock);
+
+  return address;
+}
+
+MICRO_MODULE_DEF MicroModuleStub*
+micro_module_stub(MicroModule *mm,
+                  const char *module_name,
+                  const char *symbol)
+{
+  if (!mm || !module_name || !symbol) return NULL;
+
+  size_t length;
+  uint32_t hash = _micro_module_hash(module_name, &length);
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleStub *stub = mm->stubs;
+  for (; stub; stub = stub->next)
+    if (stub->hash == hash && strcmp(stub->module_name, module_name) == 0
+        && strcmp(stub->symbol, symbol) == 0)
+      break;
+  if (stub)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return stub;
+  }
+
+  size_t symbol_length = strlen(symbol);
+  stub = _micro_module_alloc(mm, sizeof(MicroModuleStub)
+                                 + length + symbol_length + 2);
+  if (!stub)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return NULL;
+  }
+  stub->address     = NULL;
+  stub->hash        = hash;
+  stub->module_name = (char*)(stub + 1);
+  stub->symbol      = stub->module_name + length + 1;
+  memcpy(stub->module_name, module_name, length + 1);
+  memcpy(stub->symbol, symbol, symbol_length + 1);
+
+  // Target the module if it is already loaded, without loading it
+  MicroModuleIndexSlot *slot = mm->index
+    ? _micro_module_index_find(mm->index, module_name, hash, length)
+    : NULL;
+  if (slot && _micro_module_is_loaded(&slot->node->module))
+    stub->address = dlsym(slot->node->module.dlhandler, symbol);
+
+  stub->next = mm->stubs;
+  mm->stubs = stub;
+  pthread_mutex_unlock(&mm->lock);
+
+  return stub;
+}
+
+MICRO_MODULE_DEF void micro_module_free_stubs(MicroModule *mm)
+{
+  if (!mm) return;
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleStub *stub = mm->stubs;
+  mm->stubs = NULL;
+  pthread_mutex_unlock(&mm->lock);
+  while (stub)
+  {
+    MicroModuleStub *next = stub->next;
+    _micro_module_free(mm, stub);
+    stub = next;
+  }
+}
+
+#ifdef MICRO_MODULE_STATS
+
+MICRO_MODULE_DEF int
+micro_module_stats(MicroModule *mm,
+                   const char *module_name,
+                   MicroModuleStats *stats)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!stats) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  int err = MICRO_MODULE_OK;
+  pthread_mutex_lock(&mm->lock);
+  pthread_mutex_lock(&mm->stats_lock);
+  if (!module_name)
+  {
+    *stats = mm->stats;
+  }
+  else
+  {
+    MicroModuleStats *found = _micro_module_stats_find(mm, module_name);
+    if (found)
+      *stats = *found;
+    else
+      err = MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED;
+  }
+  pthread_mutex_unlock(&mm->stats_lock);
+  pthread_mutex_unlock(&mm->lock);
+  return err;
+}
+
+MICRO_MODULE_DEF void micro_module_stats_reset(MicroModule *mm)
+{
+  if (!mm) return;
+  pthread_mutex_lock(&mm->lock);
+  pthread_mutex_lock(&mm->stats_lock);
+  memset(&mm->stats, 0, sizeof(mm->stats));
+  for (MicroModuleList *it = mm->modules; it; it = it->next)
+    memset(&it->module.stats, 0, sizeof(it->module.stats));
+  pthread_mutex_unlock(&mm->stats_lock);
+  pthread_mutex_unlock(&mm->lock);
+}
+
+#endif // MICRO_MODULE_STATS
+
+// Address ranges of the segments of the objects of some namespaces
+typedef struct {
+  MicroModule *mm;
+  uintptr_t (*ranges)[2];
+  size_t count;
+  size_t capacity;
+  size_t size;
+} _MicroModuleMemoryRanges;
+
+static bool _micro_module_address_in(const uintptr_t *addresses,
+                                     size_t count,
+                                     uintptr_t address)
+{
+  for (size_t i = 0; i < count; ++i)
+    if (addresses[i] == address) return true;
+  return false;
+}
+
+// Adds the PT_LOAD segments of the object loaded at [base] to [ranges]
+static bool _micro_module_memory_segments(_MicroModuleMemoryRanges *ranges,
+                                          uintptr_t base)
+{
+  size_t phnum;
+  const ElfW(Phdr) *phdrs = _micro_module_loaded_phdrs(base, &phnum);
+  if (!phdrs) return true;
+
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < phnum; ++i)
   {
-    switch (file_entry->fts_info)
+    if (phdrs[i].p_type != PT_LOAD) continue;
+    if (ranges->count == ranges->capacity)
     {
-    case FTS_D: // Directory
-      if (file_entry->fts_level == 0)
-      {
-        // Top-level directory itself, continue
-        continue;
-      } else {
-        // Skip descending into subdirectories
-        fts_set(files, file_entry, FTS_SKIP);
-      }
-      break;
-    case FTS_F:  // Regular file
-    case FTS_SL: // Symbolic link
-    case FTS_DEFAULT:
-      if (file_entry->fts_level == 1)
+      size_t capacity = ranges->capacity ? ranges->capacity * 2 : 64;
+      uintptr_t (*bigger)[2] =
+        _micro_module_alloc(ranges->mm, capacity * sizeof(*bigger));
+      if (!bigger) return false;
+      if (ranges->count)
+        memcpy(bigger, ranges->ranges, ranges->count * sizeof(*bigger));
+      _micro_module_free(ranges->mm, ranges->ranges);
+      ranges->ranges   = bigger;
+      ranges->capacity = capacity;
+    }
+    uintptr_t start = (base + phdrs[i].p_vaddr) & ~(page - 1);
+    uintptr_t end = (base + phdrs[i].p_vaddr + phdrs[i].p_memsz
+                     + page - 1) & ~(page - 1);
+    ranges->ranges[ranges->count][0] = start;
+    ranges->ranges[ranges->count][1] = end;
+    ranges->count++;
+    ranges->size += end - start;
+  }
+  return true;
+}
+
+// Appends the load addresses of the objects of the namespace of
+// [dlhandler] to [bases], growing it. Returns false if memory ran out.
+static bool _micro_module_memory_bases(MicroModule *mm,
+                                       void *dlhandler,
+                                       uintptr_t **bases,
+                                       size_t *count,
+                                       size_t *capacity)
+{
+  struct link_map *map;
+  if (dlinfo(dlhandler, RTLD_DI_LINKMAP, &map) != 0) return true;
+  while (map->l_prev)
+    map = map->l_prev;
+  for (; map; map = map->l_next)
+  {
+    if (*count == *capacity)
+    {
+      size_t bigger_capacity = *capacity ? *capacity * 2 : 32;
+      uintptr_t *bigger =
+        _micro_module_alloc(mm, bigger_capacity * sizeof(uintptr_t));
+      if (!bigger) return false;
+      if (*count)
+        memcpy(bigger, *bases, *count * sizeof(uintptr_t));
+      _micro_module_free(mm, *bases);
+      *bases    = bigger;
+      *capacity = bigger_capacity;
+    }
+    (*bases)[(*count)++] = map->l_addr;
+  }
+  return true;
+}
+
+MICRO_MODULE_DEF int
+micro_module_memory(MicroModule *mm,
+                    const char *group,
+                    MicroModuleMemory *memory)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!memory) return MICRO_MODULE_ERROR_ARG_NULL;
+  memset(memory, 0, sizeof(*memory));
+
+  uintptr_t *bases = NULL, *shared = NULL;
+  size_t bases_count = 0, bases_capacity = 0;
+  size_t shared_count = 0, shared_capacity = 0;
+  bool ok = true;
+
+  void *main_handle = dlopen(NULL, RTLD_LAZY);
+  if (main_handle)
+  {
+    ok = _micro_module_memory_bases(mm, main_handle, &shared,
+                                    &shared_count, &shared_capacity);
+    dlclose(main_handle);
+  }
+
+  pthread_mutex_lock(&mm->lock);
+  for (size_t i = 0; i < mm->namespaces_count && ok; ++i)
+  {
+    MicroModuleNamespace *ns = &mm->namespaces[i];
+    if (!_micro_module_namespace_in(ns, group)) continue;
+    memory->namespaces++;
+    memory->modules += ns->modules;
+    ok = _micro_module_memory_bases(mm, ns->anchor, &bases,
+                                    &bases_count, &bases_capacity);
+  }
+
+  // Objects mapped once for all namespaces, like ld.so, are not counted
+  _MicroModuleMemoryRanges ranges = { .mm = mm };
+  for (size_t i = 0; i < bases_count && ok; ++i)
+  {
+    if (_micro_module_address_in(shared, shared_count, bases[i])) continue;
+    memory->objects++;
+    ok = _micro_module_memory_segments(&ranges, bases[i]);
+  }
+  pthread_mutex_unlock(&mm->lock);
+  memory->size = ranges.size;
+  _micro_module_free(mm, bases);
+  _micro_module_free(mm, shared);
+
+  // Add up the mappings of /proc/self/smaps inside the segments
+  FILE *smaps = ok && ranges.count > 0 ? fopen("/proc/self/smaps", "r") : NULL;
+  if (smaps)
+  {
+    char line[512];
+    bool inside = false;
+    while (fgets(line, sizeof(line), smaps))
+    {
+      unsigned long start, end;
+      size_t kb;
+      if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
       {
-        err = micro_module_init(mm, file_entry->fts_path, arg);
-        if (err != MICRO_MODULE_OK)
-        {
-          goto exit;
-        }
+        inside = false;
+        for (size_t i = 0; i < ranges.count && !inside; ++i)
+          inside = start >= ranges.ranges[i][0] && end <= ranges.ranges[i][1];
       }
-      break;
-    default:
-      break;
+      else if (!inside)
+        continue;
+      else if (sscanf(line, "Rss: %zu kB", &kb) == 1)
+        memory->rss += kb * 1024;
+      else if (sscanf(line, "Pss: %zu kB", &kb) == 1)
+        memory->pss += kb * 1024;
+      else if (sscanf(line, "Private_Dirty: %zu kB", &kb) == 1)
+        memory->private_dirty += kb * 1024;
     }
+    fclose(smaps);
   }
+  _micro_module_free(mm, ranges.ranges);
 
- exit:
-  if (fts_close(files) < 0 && err == MICRO_MODULE_OK)
-    return MICRO_MODULE_ERROR_CLOSE_MODULES_DIR;
-  return err;
+  if (!ok) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  return MICRO_MODULE_OK;
 }
 
 MICRO_MODULE_DEF int
@@ -417,43 +5325,146 @@ micro_module_exit(MicroModule *mm,
   if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
   if (!mm->modules) return MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED;
   if (!module_name) return MICRO_MODULE_ERROR_ARG_NULL;
-  
-  if (strcmp(mm->modules->module.name, module_name) == 0)
-  {
-    MicroModuleList *module = mm->modules;
-    mm->modules->module.exit_fn(arg);
-      if (dlclose(mm->modules->module.dlhandler) != 0)
-        return MICRO_MODULE_ERROR_CLOSING_MODULE;
-      
-    mm->modules = mm->modules->next;
-    MICRO_MODULE_FREE(module);
-    return MICRO_MODULE_OK;
+
+  size_t length;
+  uint32_t hash = _micro_module_hash(module_name, &length);
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(mm->index, module_name, hash, length);
+  if (!slot)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED;
   }
-  
-  MicroModuleList *prev = NULL;
-  MicroModuleList *it = mm->modules;
-  while(it)
+  MicroModuleList *it = _micro_module_unlink(mm, slot);
+  bool loaded = _micro_module_is_loaded(&it->module);
+  if (loaded)
+    _micro_module_retarget(mm, it->module.name, NULL);
+  pthread_mutex_unlock(&mm->lock);
+
+  // Nobody can get the module anymore, exit it without holding the
+  // lock, as draining it may wait for calls that need the lock
+  if (loaded)
   {
-    if (strcmp(it->module.name, module_name) == 0)
-    {
-      it->module.exit_fn(arg);
-      if (dlclose(it->module.dlhandler) != 0)
-        return MICRO_MODULE_ERROR_CLOSING_MODULE;
-      
-      prev->next = it->next;
-      MICRO_MODULE_FREE(it);
-      return MICRO_MODULE_OK;
-    }
-    prev = it;
-    it = it->next;
+    _micro_module_drain(&it->module);
+    _MICRO_MODULE_CLOCK(exit_start);
+    it->module.exit_fn(arg);
+    _MICRO_MODULE_RECORD(mm, &it->module.stats, MICRO_MODULE_PHASE_EXIT,
+                         exit_start);
+    _MICRO_MODULE_COUNT(mm, &it->module.stats, unloads);
   }
-  
-  return MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED;
+  // In concurrent mode, readers may still use it, it gets closed later
+  int err = MICRO_MODULE_OK;
+  if (!mm->concurrent && _micro_module_close(mm, &it->module) != MICRO_MODULE_OK)
+    err = MICRO_MODULE_ERROR_CLOSING_MODULE;
+
+  pthread_mutex_lock(&mm->lock);
+  _micro_module_retire(mm, &it->retired, _micro_module_node_free);
+  pthread_mutex_unlock(&mm->lock);
+  return err;
 }
 
 MICRO_MODULE_DEF int micro_module_exit_all(MicroModule *mm, void* arg)
+{
+  return micro_module_exit_all_parallel(mm, arg, 1);
+}
+
+MICRO_MODULE_DEF int
+micro_module_exit_all_parallel(MicroModule *mm,
+                               void* arg,
+                               unsigned int nthreads)
 {
   if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  _micro_module_async_stop(mm);
+
+  size_t count = mm->index ? mm->index->count : 0;
+  size_t *order = NULL;
+  size_t scheduled = 0;
+  if (mm->deps_symbol && count > 1)
+  {
+    order = _micro_module_alloc(mm, count * (sizeof(MicroModuleEntry*)
+                                             + sizeof(size_t) * 2 + sizeof(int)));
+    if (!order) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  }
+
+  if (order)
+  {
+    MicroModuleEntry **entries = (MicroModuleEntry**)(order + count);
+    size_t *levels = (size_t*)(entries + count);
+    int *results = (int*)(levels + count);
+    // The dependencies of the lazy modules being loaded are only known
+    // once they are loaded
+    pthread_mutex_lock(&mm->lock);
+    for (MicroModuleList *it = mm->modules; it; it = it->next)
+      _micro_module_wait_loading(mm, it);
+    pthread_mutex_unlock(&mm->lock);
+    size_t i = 0;
+    for (MicroModuleList *it = mm->modules; it; it = it->next)
+      entries[i++] = &it->module;
+
+    // Modules loaded one by one could have formed a cycle, in that
+    // case fall back to the list order
+    if (_micro_module_schedule(mm, entries, count, false,
+                               order, levels, &scheduled) != MICRO_MODULE_OK)
+      scheduled = 0;
+
+    if (nthreads == 0)
+    {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      nthreads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    _MicroModuleCalls calls = {
+      .mm      = mm,
+      .entries = entries,
+      .order   = order,
+      .results = results,
+      .arg     = arg,
+      .exit    = true,
+      .all     = true,
+    };
+
+    // Exit them level by level, dependents first. Like
+    // micro_module_exit, each level is unlinked before being exited,
+    // so that readers cannot get a module being exited.
+    size_t end = scheduled;
+    int close_err = MICRO_MODULE_OK;
+    while (end > 0 && close_err == MICRO_MODULE_OK)
+    {
+      size_t begin = end - 1;
+      while (begin > 0 && levels[order[begin - 1]] == levels[order[end - 1]])
+        begin--;
+      pthread_mutex_lock(&mm->lock);
+      for (size_t k = begin; k < end; ++k)
+      {
+        MicroModuleEntry *entry = entries[order[k]];
+        size_t length;
+        uint32_t hash = _micro_module_hash(entry->name, &length);
+        _micro_module_unlink(mm, _micro_module_index_find(mm->index,
+                                                          entry->name,
+                                                          hash, length));
+        _micro_module_retarget(mm, entry->name, NULL);
+      }
+      pthread_mutex_unlock(&mm->lock);
+      _micro_module_run_calls(&calls, begin, end, nthreads);
+
+      // In concurrent mode, readers may still use them, they get
+      // closed later
+      for (size_t k = begin; k < end; ++k)
+      {
+        MicroModuleEntry *entry = entries[order[k]];
+        if (!mm->concurrent && _micro_module_close(mm, entry) != MICRO_MODULE_OK)
+          close_err = MICRO_MODULE_ERROR_CLOSING_MODULE;
+        MicroModuleList *node = (MicroModuleList*)
+          ((char*)entry - offsetof(MicroModuleList, module));
+        pthread_mutex_lock(&mm->lock);
+        _micro_module_retire(mm, &node->retired, _micro_module_node_free);
+        pthread_mutex_unlock(&mm->lock);
+      }
+      end = begin;
+    }
+    _micro_module_free(mm, order);
+    if (close_err != MICRO_MODULE_OK) return close_err;
+  }
 
   int err = MICRO_MODULE_OK;
   MicroModuleList *it = mm->modules;
@@ -467,11 +5478,610 @@ MICRO_MODULE_DEF int micro_module_exit_all(MicroModule *mm, void* arg)
     
     it = next;
   }
-  mm->modules = NULL;
-  
+
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleIndex *index = mm->index;
+  __atomic_store_n(&mm->modules, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&mm->index, NULL, __ATOMIC_RELEASE);
+  if (index)
+    _micro_module_retire(mm, &index->retired, _micro_module_index_free);
+  pthread_mutex_unlock(&mm->lock);
+  micro_module_synchronize(mm);
+  micro_module_reap(mm);
+
+  // Every node is back, release the slabs at once
+  pthread_mutex_lock(&mm->lock);
+  if (mm->nodes_used == 0)
+  {
+    MicroModuleSlab *slab = mm->slabs;
+    while (slab)
+    {
+      MicroModuleSlab *next = slab->next;
+      for (size_t i = 0; i < slab->capacity; ++i)
+        pthread_cond_destroy(&slab->nodes[i].loaded);
+      _micro_module_free(mm, slab);
+      slab = next;
+    }
+    mm->slabs      = NULL;
+    mm->free_nodes = NULL;
+  }
+  // The emptied namespaces stay, free for any group
+  for (size_t i = 0; i < mm->namespaces_count; ++i)
+  {
+    if (mm->namespaces[i].modules > 0) continue;
+    _micro_module_free(mm, mm->namespaces[i].group);
+    mm->namespaces[i].group = NULL;
+  }
+  pthread_mutex_unlock(&mm->lock);
+
+  return MICRO_MODULE_OK;
+}
+
+MICRO_MODULE_DEF bool
+micro_module_enter(MicroModule *mm,
+                   MicroModuleEntry *module,
+                   MicroModuleCall *call)
+{
+  // Outside of concurrent mode, nothing keeps the entry alive
+  if (!mm || !mm->concurrent) return false;
+  if (!module || !call || !_micro_module_is_loaded(module)) return false;
+  // Read the entry before being counted, it may go away afterwards
+  MicroModuleRefs *refs = module->refs;
+  if (!refs) return false;
+  call->fns = module->fns;
+
+  // Pick a shard by thread, through the address of its stack
+  size_t shard = ((uintptr_t)&shard >> 12) % MICRO_MODULE_REF_SHARDS;
+  uint64_t *count = &refs->shards[shard].count;
+  __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&refs->closing, __ATOMIC_SEQ_CST))
+  {
+    __atomic_fetch_sub(count, 1, __ATOMIC_RELEASE);
+    return false;
+  }
+  call->count = count;
+  return true;
+}
+
+MICRO_MODULE_DEF void micro_module_leave(MicroModuleCall *call)
+{
+  __atomic_fetch_sub(call->count, 1, __ATOMIC_RELEASE);
+}
+
+MICRO_MODULE_DEF size_t micro_module_reap(MicroModule *mm)
+{
+  if (!mm) return 0;
+  size_t waiting = 0;
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleRefs **it = &mm->draining;
+  while (*it)
+  {
+    MicroModuleRefs *refs = *it;
+    if (!_micro_module_refs_idle(refs))
+    {
+      waiting++;
+      it = &refs->next;
+      continue;
+    }
+    *it = refs->next;
+    if (refs->dlhandler)
+    {
+      _MICRO_MODULE_CLOCK(close_start);
+      _micro_module_dlclose(mm, refs->dlhandler);
+      _MICRO_MODULE_RECORD(mm, NULL, MICRO_MODULE_PHASE_CLOSE, close_start);
+    }
+    if (refs->memfd > 0)
+      close(refs->memfd);
+    _micro_module_free(mm, refs->path);
+    _micro_module_free(mm, refs->fns);
+    _micro_module_sym_cache_free(mm, refs->syms);
+    _micro_module_free(mm, refs);
+  }
+  pthread_mutex_unlock(&mm->lock);
+  return waiting;
+}
+
+MICRO_MODULE_DEF size_t micro_module_read_lock(MicroModule *mm)
+{
+  // Start probing at a slot depending on the thread, through the
+  // address of its stack
+  size_t start = ((uintptr_t)&start >> 12) % MICRO_MODULE_MAX_READERS;
+  for (size_t i = start;; i = (i + 1) % MICRO_MODULE_MAX_READERS)
+  {
+    MicroModuleReader *reader = &mm->readers[i];
+    uint64_t expected = 0;
+    uint64_t epoch = __atomic_load_n(&mm->epoch, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&reader->epoch, __ATOMIC_RELAXED) == 0
+        && __atomic_compare_exchange_n(&reader->epoch, &expected, epoch,
+                                       false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_RELAXED))
+    {
+      // Pairs with the fence of _micro_module_reclaim
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      return i;
+    }
+    if ((i + 1) % MICRO_MODULE_MAX_READERS == start)
+      sched_yield();
+  }
+}
+
+MICRO_MODULE_DEF void micro_module_read_unlock(MicroModule *mm, size_t reader)
+{
+  __atomic_store_n(&mm->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+MICRO_MODULE_DEF MicroModuleList*
+micro_module_next(MicroModule *mm, MicroModuleList *it)
+{
+  if (!mm) return NULL;
+  return it ? __atomic_load_n(&it->next, __ATOMIC_ACQUIRE)
+            : __atomic_load_n(&mm->modules, __ATOMIC_ACQUIRE);
+}
+
+MICRO_MODULE_DEF void micro_module_synchronize(MicroModule *mm)
+{
+  for (;;)
+  {
+    pthread_mutex_lock(&mm->lock);
+    _micro_module_reclaim(mm);
+    bool done = mm->retired == NULL;
+    pthread_mutex_unlock(&mm->lock);
+    if (done) return;
+    sched_yield();
+  }
+}
+
+// A module of the synchronized directory, as it was in the registry
+typedef struct {
+  // Copies of the path and the name, in a single allocation
+  char *path;
+  char *name;
+  MicroModuleFileId file_id;
+  bool lazy;
+  // Whether its file is still there
+  bool seen;
+} _MicroModuleSyncEntry;
+
+static int _micro_module_sync_entry_compare(const void *a, const void *b)
+{
+  return strcmp(((const _MicroModuleSyncEntry*)a)->path,
+                ((const _MicroModuleSyncEntry*)b)->path);
+}
+
+// Copies the modules loaded from the directory of [dir_length] bytes
+// at [modules_dir] into [entries], sorted by path
+static int _micro_module_sync_snapshot(MicroModule *mm,
+                                       const char *modules_dir,
+                                       size_t dir_length,
+                                       _MicroModuleSyncEntry **entries,
+                                       size_t *count)
+{
+  int err = MICRO_MODULE_OK;
+  *entries = NULL;
+  *count   = 0;
+  pthread_mutex_lock(&mm->lock);
+  size_t capacity = mm->index ? mm->index->count : 0;
+  if (capacity > 0
+      && !(*entries = _micro_module_alloc(mm, capacity * sizeof(**entries))))
+    err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  for (MicroModuleList *it = mm->modules; it && err == MICRO_MODULE_OK;
+       it = it->next)
+  {
+    const MicroModuleEntry *module = &it->module;
+    if (!module->path
+        || strncmp(module->path, modules_dir, dir_length) != 0
+        || module->path[dir_length] != '/'
+        || strchr(module->path + dir_length + 1, '/'))
+      continue;
+    size_t path_length = strlen(module->path) + 1;
+    size_t name_length = strlen(module->name) + 1;
+    _MicroModuleSyncEntry *entry = &(*entries)[*count];
+    entry->path = _micro_module_alloc(mm, path_length + name_length);
+    if (!entry->path)
+    {
+      err = MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+      break;
+    }
+    entry->name = entry->path + path_length;
+    memcpy(entry->path, module->path, path_length);
+    memcpy(entry->name, module->name, name_length);
+    entry->file_id = module->file_id;
+    entry->lazy    = module->state == MICRO_MODULE_STATE_LAZY;
+    entry->seen    = false;
+    (*count)++;
+  }
+  pthread_mutex_unlock(&mm->lock);
+  if (*count > 1)
+    qsort(*entries, *count, sizeof(**entries),
+          _micro_module_sync_entry_compare);
+  return err;
+}
+
+// Whether the module [entry] is still the one in its file, of identity
+// [id]. If only their build-ids tell, the identity of the module in
+// the registry is refreshed.
+static bool _micro_module_sync_unchanged(MicroModule *mm,
+                                         const _MicroModuleSyncEntry *entry,
+                                         const MicroModuleFileId *id)
+{
+  if (entry->lazy || _micro_module_file_id_equal(&entry->file_id, id))
+    return true;
+  if (entry->file_id.build_id_length == 0) return false;
+
+  _MicroModuleElfInfo info;
+  if (_micro_module_check_file(mm, entry->path, &info) != MICRO_MODULE_OK
+      || info.file_id.build_id_length != entry->file_id.build_id_length
+      || memcmp(info.file_id.build_id, entry->file_id.build_id,
+                info.file_id.build_id_length) != 0)
+    return false;
+
+  size_t length;
+  uint32_t hash = _micro_module_hash(entry->name, &length);
+  pthread_mutex_lock(&mm->lock);
+  MicroModuleIndexSlot *slot =
+    _micro_module_index_find(mm->index, entry->name, hash, length);
+  if (slot && slot->node->module.path
+      && strcmp(slot->node->module.path, entry->path) == 0)
+    slot->node->module.file_id = info.file_id;
+  pthread_mutex_unlock(&mm->lock);
+  return true;
+}
+
+MICRO_MODULE_DEF int
+micro_module_sync(MicroModule *mm,
+                  char* modules_dir,
+                  void* arg,
+                  MicroModuleSyncReport *report)
+{
+  if (!mm) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!modules_dir) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  MicroModuleSyncReport counts;
+  memset(&counts, 0, sizeof(counts));
+  _MicroModuleBatch batch = { .mm = mm, .arg = arg };
+  _MicroModuleSyncEntry *entries = NULL;
+  size_t entries_count = 0;
+  // A directory that went away would look empty, and unload everything
+  struct stat st;
+  int err = stat(modules_dir, &st) == 0 && S_ISDIR(st.st_mode)
+    ? _micro_module_batch_scan(&batch, modules_dir)
+    : MICRO_MODULE_ERROR_OPEN_MODULES_DIR;
+  if (err != MICRO_MODULE_OK) goto exit;
+
+  // The directory as it starts the paths of its files
+  size_t dir_length = strlen(modules_dir);
+  while (dir_length > 1 && modules_dir[dir_length - 1] == '/')
+    dir_length--;
+  err = _micro_module_sync_snapshot(mm, modules_dir, dir_length,
+                                    &entries, &entries_count);
+  if (err != MICRO_MODULE_OK) goto exit;
+
+  // Find what changed, the files to load are left with err set
+  for (size_t i = 0; i < batch.count; ++i)
+  {
+    _MicroModuleBatchItem *item = &batch.items[i];
+    _MicroModuleSyncEntry key = { .path = item->path };
+    _MicroModuleSyncEntry *entry = entries_count == 0 ? NULL
+      : bsearch(&key, entries, entries_count, sizeof(*entries),
+                _micro_module_sync_entry_compare);
+    item->err = MICRO_MODULE_ERROR_MISSING_DEPENDENCY;
+    item->registered = entry != NULL;
+    if (!entry) continue;
+    entry->seen = true;
+    item->module.name = entry->name;
+    MicroModuleFileId id;
+    if (_micro_module_file_id(item->path, &id)
+        && _micro_module_sync_unchanged(mm, entry, &id))
+    {
+      item->err = MICRO_MODULE_OK;
+      counts.unchanged++;
+    }
+  }
+
+  // Unload the modules whose file went away
+  for (size_t i = 0; i < entries_count; ++i)
+  {
+    _MicroModuleSyncEntry *entry = &entries[i];
+    if (entry->seen) continue;
+    if (micro_module_exit(mm, entry->name, arg) != MICRO_MODULE_OK)
+    {
+      counts.failed++;
+      continue;
+    }
+    counts.removed++;
+    if (mm->change_fn)
+      mm->change_fn(entry->path, entry->name, MICRO_MODULE_CHANGE_REMOVED,
+                    mm->change_arg);
+  }
+
+  // Load the others, until a pass makes no progress
+  bool progress = true;
+  while (progress)
+  {
+    progress = false;
+    for (size_t i = 0; i < batch.count; ++i)
+    {
+      _MicroModuleBatchItem *item = &batch.items[i];
+      if (item->err != MICRO_MODULE_ERROR_MISSING_DEPENDENCY) continue;
+      item->err = micro_module_init(mm, item->path, arg);
+      if (item->err == MICRO_MODULE_ERROR_MISSING_DEPENDENCY) continue;
+      progress = true;
+      if (item->err != MICRO_MODULE_OK) continue;
+      if (item->registered)
+        counts.reloaded++;
+      else
+        counts.added++;
+      if (!mm->change_fn) continue;
+      if (item->registered)
+      {
+        mm->change_fn(item->path, item->module.name,
+                      MICRO_MODULE_CHANGE_RELOADED, mm->change_arg);
+        continue;
+      }
+      // New modules are registered at the head of the list
+      pthread_mutex_lock(&mm->lock);
+      const char *name = NULL;
+      for (MicroModuleList *it = mm->modules; it && !name; it = it->next)
+        if (it->module.path && strcmp(it->module.path, item->path) == 0)
+          name = it->module.name;
+      mm->change_fn(item->path, name, MICRO_MODULE_CHANGE_ADDED,
+                    mm->change_arg);
+      pthread_mutex_unlock(&mm->lock);
+    }
+  }
+  for (size_t i = 0; i < batch.count; ++i)
+  {
+    if (batch.items[i].err == MICRO_MODULE_OK) continue;
+    counts.failed++;
+    if (mm->skip_fn)
+      mm->skip_fn(batch.items[i].path, batch.items[i].err, mm->skip_arg);
+  }
+
+ exit:
+  for (size_t i = 0; i < entries_count; ++i)
+    _micro_module_free(mm, entries[i].path);
+  _micro_module_free(mm, entries);
+  _micro_module_batch_free(&batch);
+  if (report)
+    *report = counts;
+  return err;
+}
+
+MICRO_MODULE_DEF int
+micro_module_watch(MicroModule *mm,
+                   MicroModuleWatch *watch,
+                   const char *modules_dir,
+                   void* arg,
+                   unsigned int debounce_ms)
+{
+  if (!mm || !watch) return MICRO_MODULE_ERROR_IS_NULL;
+  if (!modules_dir) return MICRO_MODULE_ERROR_ARG_NULL;
+
+  memset(watch, 0, sizeof(*watch));
+  watch->mm          = mm;
+  watch->arg         = arg;
+  watch->debounce_ms = debounce_ms;
+  watch->fd = watch->inotify_fd = watch->timer_fd = -1;
+
+  // Paths are built like the ones of micro_module_init_all
+  size_t length = strlen(modules_dir);
+  while (length > 1 && modules_dir[length - 1] == '/')
+    length--;
+  watch->dir = _micro_module_alloc(mm, length + 1);
+  if (!watch->dir) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  memcpy(watch->dir, modules_dir, length);
+  watch->dir[length] = '\0';
+
+  watch->fd         = epoll_create1(EPOLL_CLOEXEC);
+  watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  watch->timer_fd   = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct epoll_event inotify_event = { .events = EPOLLIN };
+  struct epoll_event timer_event   = { .events = EPOLLIN };
+  if (watch->fd < 0 || watch->inotify_fd < 0 || watch->timer_fd < 0
+      || inotify_add_watch(watch->inotify_fd, watch->dir,
+                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE
+                           | IN_MOVED_FROM | IN_ONLYDIR) < 0
+      || epoll_ctl(watch->fd, EPOLL_CTL_ADD, watch->inotify_fd,
+                   &inotify_event) != 0
+      || epoll_ctl(watch->fd, EPOLL_CTL_ADD, watch->timer_fd,
+                   &timer_event) != 0)
+  {
+    micro_module_watch_close(watch);
+    return MICRO_MODULE_ERROR_WATCHING_MODULES_DIR;
+  }
+
+  return MICRO_MODULE_OK;
+}
+
+// Records that [name] changed, replacing its previous change
+static int _micro_module_watch_record(MicroModuleWatch *watch,
+                                      const char *name,
+                                      bool removed)
+{
+  for (size_t i = 0; i < watch->changes_count; ++i)
+  {
+    MicroModuleWatchChange *change = &watch->changes[i];
+    if (strcmp(change->name, name) != 0) continue;
+
+    // Keep the order of the latest change
+    MicroModuleWatchChange moved = *change;
+    memmove(change, change + 1,
+            (watch->changes_count - i - 1) * sizeof(*change));
+    moved.removed = removed;
+    watch->changes[watch->changes_count - 1] = moved;
+    return MICRO_MODULE_OK;
+  }
+
+  if (watch->changes_count == watch->changes_capacity)
+  {
+    size_t capacity = watch->changes_capacity ? watch->changes_capacity * 2 : 8;
+    MicroModuleWatchChange *changes =
+      _micro_module_alloc(watch->mm, capacity * sizeof(*changes));
+    if (!changes) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    if (watch->changes_count)
+      memcpy(changes, watch->changes, watch->changes_count * sizeof(*changes));
+    _micro_module_free(watch->mm, watch->changes);
+    watch->changes          = changes;
+    watch->changes_capacity = capacity;
+  }
+
+  size_t length = strlen(name) + 1;
+  char *copy = _micro_module_alloc(watch->mm, length);
+  if (!copy) return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+  memcpy(copy, name, length);
+  watch->changes[watch->changes_count].name    = copy;
+  watch->changes[watch->changes_count].removed = removed;
+  watch->changes_count++;
   return MICRO_MODULE_OK;
 }
 
+// Drops the changes of [watch]
+static void _micro_module_watch_clear(MicroModuleWatch *watch)
+{
+  for (size_t i = 0; i < watch->changes_count; ++i)
+    _micro_module_free(watch->mm, watch->changes[i].name);
+  watch->changes_count = 0;
+  watch->overflowed    = false;
+}
+
+// Applies the changes of [watch], returning how many were applied
+static int _micro_module_watch_apply(MicroModuleWatch *watch)
+{
+  MicroModule *mm = watch->mm;
+  int applied = 0;
+  if (watch->overflowed)
+  {
+    int err = micro_module_sync(mm, watch->dir, watch->arg, NULL);
+    _micro_module_watch_clear(watch);
+    return err != MICRO_MODULE_OK ? err : 1;
+  }
+
+  size_t dir_length = strlen(watch->dir);
+  for (size_t i = 0; i < watch->changes_count; ++i)
+  {
+    MicroModuleWatchChange *change = &watch->changes[i];
+    size_t name_length = strlen(change->name) + 1;
+    char *path = _micro_module_alloc(mm, dir_length + 1 + name_length);
+    if (!path)
+    {
+      _micro_module_watch_clear(watch);
+      return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+    }
+    memcpy(path, watch->dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, change->name, name_length);
+
+    if (change->removed)
+    {
+      // Unload the module that was loaded from the file, if any. Its
+      // name is copied under the lock, as the entry may be replaced
+      // once it is released.
+      char *name = NULL;
+      bool found = false;
+      pthread_mutex_lock(&mm->lock);
+      for (MicroModuleList *it = mm->modules; it && !found; it = it->next)
+      {
+        if (!it->module.path || strcmp(it->module.path, path) != 0)
+          continue;
+        size_t length = strlen(it->module.name) + 1;
+        name = _micro_module_alloc(mm, length);
+        if (name) memcpy(name, it->module.name, length);
+        found = true;
+      }
+      pthread_mutex_unlock(&mm->lock);
+      if (found && !name)
+      {
+        _micro_module_free(mm, path);
+        _micro_module_watch_clear(watch);
+        return MICRO_MODULE_ERROR_ALLOCATING_MEMORY;
+      }
+      if (name && micro_module_exit(mm, name, watch->arg) == MICRO_MODULE_OK)
+        applied++;
+      _micro_module_free(mm, name);
+    }
+    else
+    {
+      int err = micro_module_init(mm, path, watch->arg);
+      if (err == MICRO_MODULE_OK)
+        applied++;
+      else if (mm->skip_fn)
+        mm->skip_fn(path, err, mm->skip_arg);
+    }
+    _micro_module_free(mm, path);
+  }
+
+  _micro_module_watch_clear(watch);
+  return applied;
+}
+
+MICRO_MODULE_DEF int micro_module_watch_dispatch(MicroModuleWatch *watch)
+{
+  if (!watch) return MICRO_MODULE_ERROR_IS_NULL;
+
+  // Record the pending events
+  bool changed = false;
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;)
+  {
+    ssize_t length = read(watch->inotify_fd, buffer, sizeof(buffer));
+    if (length < 0 && errno == EINTR) continue;
+    if (length < 0 && errno == EAGAIN) break;
+    if (length <= 0) return MICRO_MODULE_ERROR_WATCHING_MODULES_DIR;
+
+    for (char *it = buffer; it < buffer + length; )
+    {
+      const struct inotify_event *event = (const struct inotify_event*)it;
+      it += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        watch->overflowed = true;
+        changed = true;
+      }
+      if (event->len == 0 || (event->mask & IN_ISDIR)) continue;
+
+      bool removed = (event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+      int err = _micro_module_watch_record(watch, event->name, removed);
+      if (err != MICRO_MODULE_OK) return err;
+      changed = true;
+    }
+  }
+
+  // Restart the debounce window on every burst
+  if (changed && watch->debounce_ms > 0)
+  {
+    struct itimerspec timer = {
+      .it_value = {
+        .tv_sec  = watch->debounce_ms / 1000,
+        .tv_nsec = (long)(watch->debounce_ms % 1000) * 1000000,
+      },
+    };
+    if (timerfd_settime(watch->timer_fd, 0, &timer, NULL) != 0)
+      return MICRO_MODULE_ERROR_WATCHING_MODULES_DIR;
+    return 0;
+  }
+
+  uint64_t expirations;
+  bool expired = read(watch->timer_fd, &expirations, sizeof(expirations))
+    == sizeof(expirations);
+  if (!expired && watch->debounce_ms > 0) return 0;
+  if (watch->changes_count == 0 && !watch->overflowed) return 0;
+  return _micro_module_watch_apply(watch);
+}
+
+MICRO_MODULE_DEF void micro_module_watch_close(MicroModuleWatch *watch)
+{
+  if (!watch) return;
+  _micro_module_watch_clear(watch);
+  if (watch->fd >= 0) close(watch->fd);
+  if (watch->inotify_fd >= 0) close(watch->inotify_fd);
+  if (watch->timer_fd >= 0) close(watch->timer_fd);
+  _micro_module_free(watch->mm, watch->changes);
+  _micro_module_free(watch->mm, watch->dir);
+  memset(watch, 0, sizeof(*watch));
+  watch->fd = watch->inotify_fd = watch->timer_fd = -1;
+}
+
 #endif // MICRO_MODULE_IMPLEMENTATION
 
 //
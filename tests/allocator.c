@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: MIT
+//
+// Allocating the registry through slabs and a custom allocator
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+typedef struct {
+  size_t allocs;
+  size_t frees;
+} Counts;
+
+static void *count_alloc(void *ctx, size_t size)
+{
+  ((Counts*)ctx)->allocs++;
+  return malloc(size);
+}
+
+static void count_free(void *ctx, void *ptr)
+{
+  if (ptr) ((Counts*)ctx)->frees++;
+  free(ptr);
+}
+
+// Returns the number of slabs of [mm]
+static size_t slabs(MicroModule *mm)
+{
+  size_t count = 0;
+  for (MicroModuleSlab *slab = mm->slabs; slab; slab = slab->next)
+    count++;
+  return count;
+}
+
+// Returns whether [node] was carved out of one of the slabs of [mm]
+static bool in_slabs(MicroModule *mm, MicroModuleList *node)
+{
+  for (MicroModuleSlab *slab = mm->slabs; slab; slab = slab->next)
+    if (node >= slab->nodes && node < slab->nodes + slab->capacity)
+      return true;
+  return false;
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  Counts counts = {0};
+  mm.allocator = (MicroModuleAllocator){ count_alloc, count_free, &counts };
+  char path[4096], name[32];
+  test_module(path, sizeof(path), "alpha");
+
+  // Nodes come from slabs doubling in size
+  const int modules = MICRO_MODULE_SLAB_CAPACITY + 4;
+  for (int i = 0; i < modules; ++i)
+  {
+    snprintf(name, sizeof(name), "alpha_%d", i);
+    TEST_EQUAL(micro_module_init_lazy(&mm, path, name, NULL),
+               MICRO_MODULE_OK);
+  }
+  TEST_EQUAL(mm.nodes_used, modules);
+  TEST_EQUAL(slabs(&mm), 2);
+  TEST_EQUAL(mm.slabs->capacity, 2 * MICRO_MODULE_SLAB_CAPACITY);
+  for (MicroModuleList *it = mm.modules; it; it = it->next)
+    TEST_ASSERT(in_slabs(&mm, it));
+  TEST_ASSERT(counts.allocs > 0);
+
+  // Freed nodes are reused before any new slab
+  TEST_EQUAL(micro_module_exit(&mm, "alpha_0", NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_exit(&mm, "alpha_1", NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(mm.nodes_used, modules - 2);
+  TEST_EQUAL(micro_module_init(&mm, path, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, "alpha_0", NULL),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(mm.nodes_used, modules);
+  TEST_EQUAL(slabs(&mm), 2);
+  TEST_ASSERT(in_slabs(&mm, mm.modules));
+
+  // Everything goes back to the allocator at once
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(mm.nodes_used, 0);
+  TEST_ASSERT(mm.slabs == NULL && mm.free_nodes == NULL);
+  TEST_EQUAL(counts.allocs, counts.frees);
+
+  // A failed load gives back what it took
+  test_module(path, sizeof(path), "broken");
+  TEST_ASSERT(micro_module_init(&mm, path, NULL) != MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(counts.allocs, counts.frees);
+  return 0;
+}
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+//
+// Loading modules in the background
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+#include <poll.h>
+
+static MicroModule mm;
+static int completed[8];
+static int completed_count;
+static bool entered, released;
+
+// Records the completion of [load], whose index is [arg]
+static void done(MicroModuleLoad *load, int result, void *arg)
+{
+  TEST_EQUAL(result, load->result);
+  completed[completed_count++] = (int)(intptr_t)arg;
+}
+
+// Holds the worker until the test releases it
+static void hold(MicroModuleLoad *load, int result, void *arg)
+{
+  (void)load;
+  (void)arg;
+  TEST_EQUAL(result, MICRO_MODULE_OK);
+  __atomic_store_n(&entered, true, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+// Whether the eventfd of [load] is readable
+static bool signaled(MicroModuleLoad *load)
+{
+  struct pollfd fd = { .fd = load->fd, .events = POLLIN };
+  return poll(&fd, 1, 0) == 1;
+}
+
+int main(void)
+{
+  mm = micro_module_setup("micro_module_name",
+                          "micro_module_init",
+                          "micro_module_exit",
+                          false);
+  char alpha[4096], beta[4096], gamma[4096];
+  test_module(alpha, sizeof(alpha), "alpha");
+  test_module(beta, sizeof(beta), "beta");
+  test_module(gamma, sizeof(gamma), "gamma");
+  int loaded = 0;
+  TEST_ASSERT(micro_module_init_async(NULL, alpha, NULL, NULL, NULL) == NULL);
+  TEST_ASSERT(micro_module_init_async(&mm, NULL, NULL, NULL, NULL) == NULL);
+
+  // Loads complete in the order they were queued, through their
+  // callback, their eventfd and micro_module_load_wait
+  MicroModuleLoad *loads[3] = {
+    micro_module_init_async(&mm, alpha, &loaded, done, (void*)0),
+    micro_module_init_async(&mm, TEST_MODULES "/missing.so", &loaded,
+                            done, (void*)1),
+    micro_module_init_async(&mm, beta, &loaded, done, (void*)2),
+  };
+  TEST_EQUAL(micro_module_load_wait(loads[0]), MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_load_wait(loads[1]) != MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_load_wait(loads[2]), MICRO_MODULE_OK);
+  struct pollfd fd = { .fd = loads[2]->fd, .events = POLLIN };
+  TEST_EQUAL(poll(&fd, 1, 1000), 1);
+  TEST_EQUAL(completed_count, 3);
+  for (int i = 0; i < 3; ++i)
+  {
+    TEST_EQUAL(completed[i], i);
+    TEST_ASSERT(signaled(loads[i]));
+    TEST_EQUAL(loads[i]->state, MICRO_MODULE_LOAD_DONE);
+    micro_module_load_free(loads[i]);
+  }
+  TEST_EQUAL(loaded, 2);
+  TEST_ASSERT(micro_module_get(&mm, "beta") != NULL);
+
+  // Queued loads can be canceled, not running ones
+  MicroModuleLoad *running =
+    micro_module_init_async(&mm, gamma, &loaded, hold, NULL);
+  while (!__atomic_load_n(&entered, __ATOMIC_ACQUIRE))
+    sched_yield();
+  MicroModuleLoad *queued =
+    micro_module_init_async(&mm, alpha, &loaded, done, (void*)3);
+  TEST_ASSERT(micro_module_load_cancel(queued));
+  TEST_ASSERT(!micro_module_load_cancel(queued));
+  TEST_ASSERT(!micro_module_load_cancel(running));
+  TEST_EQUAL(completed[completed_count - 1], 3);
+  TEST_ASSERT(signaled(queued));
+  TEST_EQUAL(micro_module_load_wait(queued), MICRO_MODULE_ERROR_CANCELED);
+  __atomic_store_n(&released, true, __ATOMIC_RELEASE);
+  TEST_EQUAL(micro_module_load_wait(running), MICRO_MODULE_OK);
+  micro_module_load_free(running);
+  micro_module_load_free(queued);
+  TEST_EQUAL(loaded, 3);
+
+  // Exiting everything cancels the queued loads and waits for the
+  // running one
+  for (int i = 0; i < 3; ++i)
+    loads[i] = micro_module_init_async(&mm, i % 2 ? beta : alpha, &loaded,
+                                       NULL, NULL);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  for (int i = 0; i < 3; ++i)
+  {
+    int result = micro_module_load_wait(loads[i]);
+    TEST_ASSERT(result == MICRO_MODULE_OK
+                || result == MICRO_MODULE_ERROR_CANCELED);
+    micro_module_load_free(loads[i]);
+  }
+  TEST_ASSERT(mm.async_head == NULL);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  return 0;
+}
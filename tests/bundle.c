@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+//
+// Writing modules to a bundle and loading them from it
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.deps_symbol = "micro_module_deps";
+  char dir[256], bundle[4096], top[4096], middle[4096], base[4096];
+  char alpha[4096], text[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(bundle, sizeof(bundle), "%s/modules.bundle", dir);
+  snprintf(text, sizeof(text), "%s/notes.txt", dir);
+  test_module(top, sizeof(top), "top");
+  test_module(middle, sizeof(middle), "middle");
+  test_module(base, sizeof(base), "base");
+  test_module(alpha, sizeof(alpha), "alpha");
+  FILE *notes = fopen(text, "w");
+  TEST_ASSERT(notes && fputs("not a module\n", notes) >= 0);
+  fclose(notes);
+
+  // Only modules with distinct names are bundled
+  const char *invalid[] = { alpha, text };
+  TEST_EQUAL(micro_module_write_bundle(&mm, bundle, invalid, 2),
+             MICRO_MODULE_ERROR_NOT_A_MODULE);
+  const char *twice[] = { alpha, alpha };
+  TEST_EQUAL(micro_module_write_bundle(&mm, bundle, twice, 2),
+             MICRO_MODULE_ERROR_BAD_BUNDLE);
+
+  // Modules come back in the order of their dependencies, each from
+  // a memfd of its own
+  const char *files[] = { top, middle, base, alpha };
+  TEST_EQUAL(micro_module_write_bundle(&mm, bundle, files, 4),
+             MICRO_MODULE_OK);
+  int fds = test_fds();
+  int order = 0;
+  TEST_EQUAL(micro_module_init_bundle(&mm, bundle, &order), MICRO_MODULE_OK);
+  TEST_EQUAL(order, 4);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "base"), "init_order"), 1);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "alpha"), "init_order"), 2);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "middle"), "init_order"), 3);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "top"), "init_order"), 4);
+  TEST_ASSERT(strncmp(micro_module_get(&mm, "top")->path,
+                      "/proc/self/fd/", 14) == 0);
+  TEST_EQUAL(test_fds(), fds + 4);
+  TEST_EQUAL(micro_module_exit_all(&mm, &order), MICRO_MODULE_OK);
+  TEST_EQUAL(test_fds(), fds);
+
+  // Or only the named ones, which must be in the bundle
+  const char *some[] = { "alpha", "base", NULL };
+  TEST_EQUAL(micro_module_init_bundle_modules(&mm, bundle, some, NULL),
+             MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "top") == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") != NULL);
+  const char *missing[] = { "missing", NULL };
+  TEST_EQUAL(micro_module_init_bundle_modules(&mm, bundle, missing, NULL),
+             MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+
+  // Dependencies that are not bundled nor loaded fail the load
+  const char *orphan[] = { top, alpha };
+  TEST_EQUAL(micro_module_write_bundle(&mm, bundle, orphan, 2),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_init_bundle(&mm, bundle, NULL),
+             MICRO_MODULE_ERROR_MISSING_DEPENDENCY);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") != NULL);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(test_fds(), fds);
+
+  // Images are always checked against their hash
+  TEST_EQUAL(micro_module_write_bundle(&mm, bundle, files, 4),
+             MICRO_MODULE_OK);
+  int fd = open(bundle, O_RDWR);
+  TEST_ASSERT(fd >= 0);
+  MicroModuleBundleIndex index;
+  TEST_ASSERT(pread(fd, &index, sizeof(index), sizeof(MicroModuleBundleHeader))
+              == sizeof(index));
+  unsigned char byte;
+  off_t offset = (off_t)(index.offset + index.size / 2);
+  TEST_ASSERT(pread(fd, &byte, 1, offset) == 1);
+  byte ^= 0xff;
+  TEST_ASSERT(pwrite(fd, &byte, 1, offset) == 1);
+  close(fd);
+  mm.check_files = false;
+  TEST_EQUAL(micro_module_init_bundle(&mm, bundle, NULL),
+             MICRO_MODULE_ERROR_BAD_BUNDLE);
+  TEST_ASSERT(mm.modules == NULL);
+  TEST_EQUAL(test_fds(), fds);
+
+  // So is their layout
+  TEST_ASSERT(truncate(bundle, 16) == 0);
+  TEST_EQUAL(micro_module_init_bundle(&mm, bundle, NULL),
+             MICRO_MODULE_ERROR_BAD_BUNDLE);
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: MIT
+//
+// Keeping modules mapped while calls are in flight in them
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+enum { VERSION, ACTIVE };
+
+static MicroModule mm;
+static bool stop;
+
+static int call_version(MicroModuleCall *call)
+{
+  int (*fn)(void);
+  *(void**)(&fn) = call->fns[VERSION];
+  return fn();
+}
+
+// Calls the module while it is being reloaded
+static void *caller(void *arg)
+{
+  size_t *calls = arg;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+  {
+    MicroModuleCall call;
+    size_t reader = micro_module_read_lock(&mm);
+    MicroModuleEntry *module = micro_module_get(&mm, "version");
+    bool entered = micro_module_enter(&mm, module, &call);
+    micro_module_read_unlock(&mm, reader);
+    if (!entered) continue;
+
+    // A new version is only seen once initialized, and is neither
+    // exited nor closed until the call ends, even if the call takes the
+    // lock of the registry
+    int version = call_version(&call);
+    TEST_ASSERT(version == 1 || version == 2);
+    TEST_EQUAL(__atomic_load_n((int*)call.fns[ACTIVE], __ATOMIC_ACQUIRE), 1);
+    TEST_ASSERT(micro_module_stub(&mm, "version", "version") != NULL);
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 50000 };
+    nanosleep(&pause, NULL);
+    TEST_EQUAL(__atomic_load_n((int*)call.fns[ACTIVE], __ATOMIC_ACQUIRE), 1);
+    TEST_EQUAL(call_version(&call), version);
+    micro_module_leave(&call);
+    (*calls)++;
+  }
+  return NULL;
+}
+
+// Replaces [file] by the test module [name]
+static void deploy(const char *file, const char *name)
+{
+  char from[4096];
+  test_module(from, sizeof(from), name);
+  test_replace(from, file);
+}
+
+int main(void)
+{
+  mm = micro_module_setup("micro_module_name",
+                          "micro_module_init",
+                          "micro_module_exit",
+                          false);
+  static const MicroModuleSymbol symbols[] = {
+    [VERSION] = { "version", true },
+    [ACTIVE]  = { "active", true },
+  };
+  mm.symbols       = symbols;
+  mm.symbols_count = 2;
+  // Each version is its own instance, unmapped once closed
+  mm.shadow_copy   = true;
+  char dir[256], file[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  deploy(file, "version1");
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+
+  // Guards need the entries to outlive the read-side critical sections
+  MicroModuleCall call;
+  TEST_ASSERT(!micro_module_enter(&mm, micro_module_get(&mm, "version"),
+                                  &call));
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+
+  mm.concurrent = true;
+  mm.drain_timeout_ms = 10000;
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  pthread_t threads[4];
+  size_t calls[4] = {0};
+  for (int i = 0; i < 4; ++i)
+    TEST_ASSERT(pthread_create(&threads[i], NULL, caller, &calls[i]) == 0);
+  for (int i = 0; i < 100; ++i)
+  {
+    deploy(file, i % 2 ? "version1" : "version2");
+    TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  }
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  for (int i = 0; i < 4; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    TEST_ASSERT(calls[i] > 0);
+  }
+
+  // Without waiting, a module unloaded during a call is closed once
+  // the call ended
+  mm.drain_timeout_ms = 0;
+  size_t reader = micro_module_read_lock(&mm);
+  TEST_ASSERT(micro_module_enter(&mm, micro_module_get(&mm, "version"),
+                                 &call));
+  micro_module_read_unlock(&mm, reader);
+  TEST_EQUAL(micro_module_exit(&mm, "version", NULL), MICRO_MODULE_OK);
+  micro_module_synchronize(&mm);
+  TEST_EQUAL(micro_module_reap(&mm), 1);
+  TEST_EQUAL(call_version(&call), 1);
+  TEST_EQUAL(*(int*)call.fns[ACTIVE], 0);
+  micro_module_leave(&call);
+  TEST_EQUAL(micro_module_reap(&mm), 0);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  micro_module_free_stubs(&mm);
+  test_dir_remove(dir);
+  return 0;
+}
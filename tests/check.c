@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+//
+// Checking module files through their ELF headers
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  char dir[256], path[4096], file[4096];
+
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_check(&mm, path), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_check(NULL, path), MICRO_MODULE_ERROR_IS_NULL);
+  TEST_EQUAL(micro_module_check(&mm, NULL), MICRO_MODULE_ERROR_ARG_NULL);
+  TEST_EQUAL(micro_module_check(&mm, TEST_MODULES "/missing.so"),
+             MICRO_MODULE_ERROR_OPENING_MODULE);
+
+  // Missing symbols, each reported by its own error
+  mm.init_fn_symbol = "missing_init";
+  TEST_EQUAL(micro_module_check(&mm, path),
+             MICRO_MODULE_ERROR_LOCATING_INIT_SYMBOL);
+  mm.init_fn_symbol = "micro_module_init";
+  mm.exit_fn_symbol = "missing_exit";
+  TEST_EQUAL(micro_module_check(&mm, path),
+             MICRO_MODULE_ERROR_LOCATING_EXIT_SYMBOL);
+  mm.exit_fn_symbol = "micro_module_exit";
+  mm.name_symbol = "missing_name";
+  TEST_EQUAL(micro_module_check(&mm, path),
+             MICRO_MODULE_ERROR_LOCATING_NAME_SYMBOL);
+  mm.name_symbol = "micro_module_name";
+
+  // Only required symbols must be defined
+  MicroModuleSymbol symbols[] = {
+    { "version", true },
+    { "missing", false },
+  };
+  mm.symbols = symbols;
+  mm.symbols_count = 2;
+  TEST_EQUAL(micro_module_check(&mm, path), MICRO_MODULE_OK);
+  symbols[1].required = true;
+  TEST_EQUAL(micro_module_check(&mm, path),
+             MICRO_MODULE_ERROR_LOCATING_SYMBOL);
+  mm.symbols = NULL;
+  mm.symbols_count = 0;
+
+  // Files that are not shared objects, or truncated ones
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/notes.txt", dir);
+  FILE *notes = fopen(file, "w");
+  TEST_ASSERT(notes != NULL);
+  fputs("not a module\n", notes);
+  fclose(notes);
+  TEST_EQUAL(micro_module_check(&mm, file), MICRO_MODULE_ERROR_NOT_A_MODULE);
+  snprintf(file, sizeof(file), "%s/empty.so", dir);
+  fclose(fopen(file, "w"));
+  TEST_EQUAL(micro_module_check(&mm, file), MICRO_MODULE_ERROR_NOT_A_MODULE);
+  snprintf(file, sizeof(file), "%s/truncated.so", dir);
+  test_copy(path, file);
+  TEST_ASSERT(truncate(file, 256) == 0);
+  TEST_EQUAL(micro_module_check(&mm, file), MICRO_MODULE_ERROR_NOT_A_MODULE);
+
+  // Loading checks the file first, unless told not to
+  int loaded = 0;
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded),
+             MICRO_MODULE_ERROR_NOT_A_MODULE);
+  mm.check_files = false;
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded),
+             MICRO_MODULE_ERROR_OPENING_MODULE);
+  TEST_EQUAL(loaded, 0);
+  TEST_ASSERT(mm.modules == NULL);
+
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT
+//
+// Reading the registry from many threads while it is changed
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static MicroModule mm;
+static bool stop;
+
+static void *reader(void *arg)
+{
+  (void)arg;
+  const char *names[] = { "alpha", "beta", "gamma" };
+  size_t reads = 0;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE) || reads == 0)
+  {
+    size_t reader = micro_module_read_lock(&mm);
+    // The modules come and go, alpha while it is reloaded, and are
+    // only seen once initialized
+    for (int i = 0; i < 3; ++i)
+    {
+      MicroModuleEntry *module = micro_module_get(&mm, names[i]);
+      if (!module) continue;
+      TEST_ASSERT(strcmp(module->name, names[i]) == 0);
+      MicroModuleCall call;
+      if (!micro_module_enter(&mm, module, &call)) continue;
+      TEST_EQUAL(test_int(module, "active"), 1);
+      micro_module_leave(&call);
+    }
+    size_t count = 0;
+    for (MicroModuleList *it = micro_module_next(&mm, NULL); it;
+         it = micro_module_next(&mm, it))
+    {
+      TEST_ASSERT(it->module.name[0] != '\0');
+      count++;
+    }
+    TEST_ASSERT(count <= 3);
+    micro_module_read_unlock(&mm, reader);
+    reads++;
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  mm = micro_module_setup("micro_module_name",
+                          "micro_module_init",
+                          "micro_module_exit",
+                          false);
+  mm.concurrent = true;
+  mm.drain_timeout_ms = 1000;
+  char alpha[4096], beta[4096], gamma[4096];
+  test_module(alpha, sizeof(alpha), "alpha");
+  test_module(beta, sizeof(beta), "beta");
+  test_module(gamma, sizeof(gamma), "gamma");
+  int loaded = 0;
+  TEST_EQUAL(micro_module_init(&mm, alpha, &loaded), MICRO_MODULE_OK);
+
+  pthread_t threads[4];
+  for (int i = 0; i < 4; ++i)
+    TEST_ASSERT(pthread_create(&threads[i], NULL, reader, NULL) == 0);
+
+  for (int i = 0; i < 200; ++i)
+  {
+    TEST_EQUAL(micro_module_init(&mm, alpha, &loaded), MICRO_MODULE_OK);
+    TEST_EQUAL(micro_module_init(&mm, beta, &loaded), MICRO_MODULE_OK);
+    TEST_EQUAL(micro_module_init_lazy(&mm, gamma, NULL, &loaded),
+               MICRO_MODULE_OK);
+    TEST_EQUAL(micro_module_exit(&mm, "beta", &loaded), MICRO_MODULE_OK);
+    if (i % 2)
+      TEST_EQUAL(micro_module_exit(&mm, "gamma", &loaded), MICRO_MODULE_OK);
+  }
+
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  for (int i = 0; i < 4; ++i)
+    pthread_join(threads[i], NULL);
+
+  // Everything unlinked is freed once the readers left
+  micro_module_synchronize(&mm);
+  TEST_ASSERT(mm.retired == NULL);
+  TEST_EQUAL(mm.nodes_used, 1);
+  TEST_EQUAL(loaded, 1);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  TEST_EQUAL(mm.nodes_used, 0);
+  TEST_ASSERT(mm.slabs == NULL);
+  return 0;
+}
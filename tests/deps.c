@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+//
+// Initializing and exiting modules in dependency order
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static MicroModule *registry;
+static int exited;
+
+// Checks that a module being initialized or exited cannot be found,
+// while its dependencies are registered before it and its dependents
+// are exited before it
+static void probe(const char *name, int initializing)
+{
+  TEST_ASSERT(micro_module_get(registry, name) == NULL);
+  bool top = strcmp(name, "probe_top") == 0;
+  if (initializing)
+  {
+    if (top)
+      TEST_ASSERT(micro_module_get(registry, "probe_base") != NULL);
+    return;
+  }
+  if (!top)
+    TEST_ASSERT(micro_module_get(registry, "probe_top") == NULL);
+  exited++;
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.deps_symbol = "micro_module_deps";
+  char dir[256], path[4096];
+  int loaded = 0;
+
+  // Whatever the directory order, dependencies come first
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "top");
+  test_install(dir, "middle");
+  test_install(dir, "base");
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 4),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 3);
+  MicroModuleEntry *base   = micro_module_get(&mm, "base");
+  MicroModuleEntry *middle = micro_module_get(&mm, "middle");
+  MicroModuleEntry *top    = micro_module_get(&mm, "top");
+  TEST_EQUAL(test_int(base, "init_order"), 1);
+  TEST_EQUAL(test_int(middle, "init_order"), 2);
+  TEST_EQUAL(test_int(top, "init_order"), 3);
+  TEST_ASSERT(base->deps == NULL);
+  TEST_ASSERT(strcmp(top->deps[0], "middle") == 0 && top->deps[2] == NULL);
+
+  // Dependents are exited first. The modules are pinned to read their
+  // counters once unloaded.
+  MicroModuleEntry *modules[3] = { base, middle, top };
+  void *pins[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    pins[i] = dlopen(modules[i]->path, RTLD_NOW | RTLD_NOLOAD);
+    TEST_ASSERT(pins[i] == modules[i]->dlhandler);
+  }
+  TEST_EQUAL(micro_module_exit_all_parallel(&mm, &loaded, 4),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  for (int i = 0; i < 3; ++i)
+  {
+    TEST_EQUAL(*(int*)dlsym(pins[i], "exit_order"), i + 1);
+    dlclose(pins[i]);
+  }
+  test_dir_remove(dir);
+
+  // Modules are registered once initialized, and unregistered before
+  // being exited
+  registry = &mm;
+  TestProbe probing = { probe };
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "probe_top");
+  test_install(dir, "probe_base");
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &probing, 2),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_exit_all_parallel(&mm, &probing, 2),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(exited, 2);
+  TEST_ASSERT(mm.modules == NULL);
+  test_dir_remove(dir);
+
+  // Single modules need their dependencies registered
+  test_module(path, sizeof(path), "middle");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded),
+             MICRO_MODULE_ERROR_MISSING_DEPENDENCY);
+  test_module(path, sizeof(path), "base");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  test_module(path, sizeof(path), "middle");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 2);
+  TEST_EQUAL(micro_module_exit_all_parallel(&mm, &loaded, 2),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+
+  // Missing dependencies and cycles load nothing
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "top");
+  TEST_EQUAL(micro_module_init_all(&mm, dir, &loaded),
+             MICRO_MODULE_ERROR_MISSING_DEPENDENCY);
+  TEST_ASSERT(mm.modules == NULL);
+  test_dir_remove(dir);
+
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "cycle_a");
+  test_install(dir, "cycle_b");
+  TEST_EQUAL(micro_module_init_all(&mm, dir, &loaded),
+             MICRO_MODULE_ERROR_DEPENDENCY_CYCLE);
+  TEST_ASSERT(mm.modules == NULL);
+  test_dir_remove(dir);
+
+  // The dependents of a module failing to initialize are not
+  // initialized
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "broken");
+  test_install(dir, "needs_broken");
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 2), -1);
+  TEST_ASSERT(micro_module_get(&mm, "needs_broken") == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "broken") == NULL);
+  TEST_ASSERT(mm.modules == NULL);
+  TEST_EQUAL(loaded, 0);
+  micro_module_exit_all(&mm, NULL);
+  test_dir_remove(dir);
+  return 0;
+}
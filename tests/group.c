@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: MIT
+//
+// Isolating groups of modules in their own namespaces
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static MicroModule mm;
+
+// alpha and beta share a group, gamma has its own, the others none
+static const char *group_of(const char *path, void *arg)
+{
+  const char *prefix = arg;
+  const char *file = strrchr(path, '/');
+  file = file ? file + 1 : path;
+  if (strcmp(file, "alpha.so") == 0 || strcmp(file, "beta.so") == 0)
+    return prefix;
+  if (strcmp(file, "gamma.so") == 0)
+    return "gamma";
+  return NULL;
+}
+
+// Loads the test module [name], returning the error
+static int load(const char *name)
+{
+  char path[4096];
+  test_module(path, sizeof(path), name);
+  return micro_module_init(&mm, path, NULL);
+}
+
+// Returns the namespace the module called [name] was opened in
+static long lmid_of(const char *name)
+{
+  Lmid_t lmid;
+  TEST_ASSERT(dlinfo(micro_module_get(&mm, name)->dlhandler,
+                     RTLD_DI_LMID, &lmid) == 0);
+  return (long)lmid;
+}
+
+int main(void)
+{
+  mm = micro_module_setup("micro_module_name",
+                          "micro_module_init",
+                          "micro_module_exit",
+                          true);
+  mm.group_fn  = group_of;
+  mm.group_arg = "shared";
+  MicroModuleMemory memory;
+  TEST_EQUAL(micro_module_memory(NULL, NULL, &memory),
+             MICRO_MODULE_ERROR_IS_NULL);
+  TEST_EQUAL(micro_module_memory(&mm, NULL, NULL),
+             MICRO_MODULE_ERROR_ARG_NULL);
+
+  // The modules of a group share a namespace, apart from the others
+  TEST_EQUAL(load("alpha"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("beta"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("gamma"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("delta"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("epsilon"), MICRO_MODULE_OK);
+  TEST_EQUAL(lmid_of("alpha"), lmid_of("beta"));
+  TEST_ASSERT(lmid_of("alpha") != lmid_of("gamma"));
+  TEST_ASSERT(lmid_of("delta") != lmid_of("alpha"));
+  TEST_ASSERT(lmid_of("delta") != lmid_of("gamma"));
+  TEST_EQUAL(mm.namespaces_count, 4);
+
+  // Their memory is measured per group, the C library of each
+  // namespace included
+  TEST_EQUAL(micro_module_memory(&mm, "shared", &memory), MICRO_MODULE_OK);
+  TEST_EQUAL(memory.namespaces, 1);
+  TEST_EQUAL(memory.modules, 2);
+  TEST_ASSERT(memory.objects >= 3);
+  TEST_ASSERT(memory.size > 0 && memory.rss > 0);
+  TEST_ASSERT(memory.pss <= memory.rss);
+  MicroModuleMemory ungrouped;
+  TEST_EQUAL(micro_module_memory(&mm, NULL, &ungrouped), MICRO_MODULE_OK);
+  TEST_EQUAL(ungrouped.namespaces, 2);
+  TEST_EQUAL(ungrouped.modules, 2);
+  TEST_ASSERT(ungrouped.objects >= 4);
+  TEST_EQUAL(micro_module_memory(&mm, "missing", &memory), MICRO_MODULE_OK);
+  TEST_EQUAL(memory.namespaces, 0);
+  TEST_EQUAL(memory.size, 0);
+
+  // Emptied namespaces are given to new groups
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  mm.group_arg = "other";
+  TEST_EQUAL(load("alpha"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("beta"), MICRO_MODULE_OK);
+  TEST_EQUAL(mm.namespaces_count, 4);
+  TEST_EQUAL(micro_module_memory(&mm, "other", &memory), MICRO_MODULE_OK);
+  TEST_EQUAL(memory.namespaces, 1);
+  TEST_EQUAL(memory.modules, 2);
+  TEST_EQUAL(micro_module_memory(&mm, "shared", &memory), MICRO_MODULE_OK);
+  TEST_EQUAL(memory.modules, 0);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  return 0;
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: MIT
+//
+// Registering modules and loading them on first use
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static MicroModule *registry;
+static bool initializing, released;
+
+// Blocks the init function of a probing module until released. The
+// module cannot get itself meanwhile.
+static void block(const char *name, int init)
+{
+  if (!init) return;
+  __atomic_store_n(&initializing, true, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE))
+  {
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+    nanosleep(&pause, NULL);
+  }
+  TEST_ASSERT(micro_module_get(registry, name) == NULL);
+}
+
+static void *get_probe_base(void *arg)
+{
+  (void)arg;
+  return micro_module_get(registry, "probe_base");
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.deps_symbol = "micro_module_deps";
+  char dir[256], path[4096];
+  int loaded = 0;
+
+  // The module is opened by the first lookup
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &loaded),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  MicroModuleEntry *lazy = &mm.modules->module;
+  TEST_ASSERT(strcmp(lazy->name, "alpha") == 0);
+  TEST_EQUAL(lazy->state, MICRO_MODULE_STATE_LAZY);
+  TEST_ASSERT(lazy->dlhandler == NULL);
+  MicroModuleEntry *alpha = micro_module_get(&mm, "alpha");
+  TEST_ASSERT(alpha == lazy);
+  TEST_EQUAL(alpha->state, MICRO_MODULE_STATE_LOADED);
+  TEST_EQUAL(loaded, 1);
+  TEST_ASSERT(alpha->file_id.ino != 0);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == alpha);
+  TEST_EQUAL(test_int(alpha, "inits"), 1);
+
+  // A module exporting another name fails to load, once
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, "other", &loaded),
+             MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "other") == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "other") == NULL);
+  TEST_EQUAL(loaded, 1);
+
+  // Dependencies are loaded first, cycles fail
+  test_module(path, sizeof(path), "middle");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &loaded),
+             MICRO_MODULE_OK);
+  test_module(path, sizeof(path), "base");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &loaded),
+             MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "middle") != NULL);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "base"), "init_order"), 2);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "middle"), "init_order"), 3);
+  test_module(path, sizeof(path), "cycle_a");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &loaded),
+             MICRO_MODULE_OK);
+  test_module(path, sizeof(path), "cycle_b");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &loaded),
+             MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "cycle_a") == NULL);
+  TEST_EQUAL(loaded, 3);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+
+  // Synchronizing a directory keeps the modules loaded on first use
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "alpha");
+  test_install(dir, "beta");
+  TEST_EQUAL(micro_module_init_all_lazy(&mm, dir, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  MicroModuleSyncReport report;
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  TEST_EQUAL(report.unchanged, 2);
+  TEST_EQUAL(loaded, 0);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") != NULL);
+  TEST_ASSERT(micro_module_get(&mm, "beta") != NULL);
+  TEST_EQUAL(loaded, 2);
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  TEST_EQUAL(report.reloaded, 0);
+  TEST_EQUAL(report.unchanged, 2);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "alpha"), "inits"), 1);
+  TEST_EQUAL(loaded, 2);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  test_dir_remove(dir);
+
+  // The registry stays usable while a module is loaded on first use,
+  // and the other threads asking for it wait for it
+  registry = &mm;
+  TestProbe blocking = { block };
+  test_module(path, sizeof(path), "probe_base");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &blocking),
+             MICRO_MODULE_OK);
+  pthread_t first, second;
+  TEST_ASSERT(pthread_create(&first, NULL, get_probe_base, NULL) == 0);
+  while (!__atomic_load_n(&initializing, __ATOMIC_ACQUIRE))
+  {
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+    nanosleep(&pause, NULL);
+  }
+  TEST_ASSERT(pthread_create(&second, NULL, get_probe_base, NULL) == 0);
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") != NULL);
+  TEST_EQUAL(mm.modules->next->module.state, MICRO_MODULE_STATE_LOADING);
+  __atomic_store_n(&released, true, __ATOMIC_RELEASE);
+  void *got_first, *got_second;
+  pthread_join(first, &got_first);
+  pthread_join(second, &got_second);
+  TEST_ASSERT(got_first != NULL && got_first == got_second);
+  TEST_EQUAL(test_int(got_first, "inits"), 1);
+  TEST_EQUAL(micro_module_exit(&mm, "probe_base", &blocking),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  return 0;
+}
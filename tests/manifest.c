@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: MIT
+//
+// Loading directories through the manifest cache
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+// Inode of [path], which changes each time the manifest is written
+static ino_t inode(const char *path)
+{
+  struct stat st;
+  TEST_ASSERT(stat(path, &st) == 0);
+  return st.st_ino;
+}
+
+// Sets the tab separated [field] of the manifest record of the module
+// [name] to [value]
+static void corrupt(const char *manifest, const char *name,
+                    int field, const char *value)
+{
+  char out[1 << 14];
+  size_t size = 0;
+  char line[4096];
+  bool found = false;
+  FILE *file = fopen(manifest, "r");
+  TEST_ASSERT(file != NULL);
+  while (fgets(line, sizeof(line), file))
+  {
+    char *fields[16];
+    int count = 0;
+    char *rest = line;
+    line[strcspn(line, "\n")] = '\0';
+    while (rest && count < 16)
+      fields[count++] = strsep(&rest, "\t");
+    if (count == 14 && strcmp(fields[0], "module") == 0
+        && strcmp(fields[12], name) == 0)
+    {
+      fields[field] = (char*)value;
+      found = true;
+    }
+    for (int i = 0; i < count; ++i)
+      size += (size_t)snprintf(out + size, sizeof(out) - size, "%s%s",
+                               fields[i], i + 1 < count ? "\t" : "\n");
+    TEST_ASSERT(size < sizeof(out));
+  }
+  fclose(file);
+  TEST_ASSERT(found);
+  file = fopen(manifest, "w");
+  TEST_ASSERT(file != NULL);
+  TEST_ASSERT(fwrite(out, 1, size, file) == size);
+  fclose(file);
+}
+
+// Loads [dir], checks that its modules are initialized once, and
+// unloads them
+static void load(MicroModule *mm, char *dir)
+{
+  int loaded = 0;
+  TEST_EQUAL(micro_module_init_all(mm, dir, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 3);
+  TEST_EQUAL(test_int(micro_module_get(mm, "alpha"), "inits"), 1);
+  TEST_EQUAL(test_int(micro_module_get(mm, "beta"), "inits"), 1);
+  TEST_ASSERT(micro_module_get(mm, "delta")->independent);
+  TEST_EQUAL(micro_module_exit_all(mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.independent_symbol = "micro_module_independent";
+  char dir[256], cache[256], manifest[4096];
+
+  test_dir(dir, sizeof(dir));
+  test_dir(cache, sizeof(cache));
+  snprintf(manifest, sizeof(manifest), "%s/manifest", cache);
+  mm.manifest_path = manifest;
+  test_install(dir, "alpha");
+  test_install(dir, "beta");
+  test_install(dir, "delta");
+
+  // The first load writes the manifest, the next ones only read it
+  load(&mm, dir);
+  ino_t written = inode(manifest);
+  load(&mm, dir);
+  TEST_EQUAL(inode(manifest), written);
+
+  // Offsets out of the module fall back to looking the symbols up, and
+  // the manifest is written again
+  corrupt(manifest, "alpha", 8, "1099511627776");
+  load(&mm, dir);
+  TEST_ASSERT(inode(manifest) != written);
+  written = inode(manifest);
+  load(&mm, dir);
+  TEST_EQUAL(inode(manifest), written);
+
+  corrupt(manifest, "beta", 7, "18446744073709551615");
+  load(&mm, dir);
+  corrupt(manifest, "beta", 7, "0");
+  load(&mm, dir);
+  corrupt(manifest, "delta", 10, "1099511627776");
+  load(&mm, dir);
+  corrupt(manifest, "delta", 11, "18446744073709551615");
+  load(&mm, dir);
+  written = inode(manifest);
+  load(&mm, dir);
+  TEST_EQUAL(inode(manifest), written);
+
+  test_dir_remove(dir);
+  test_dir_remove(cache);
+  return 0;
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+//
+// Loading modules from memory through sealed memfds
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+// Reads the test module [name] into a new buffer, whose size is
+// written to [size]
+static char *image(const char *name, size_t *size)
+{
+  char path[4096];
+  test_module(path, sizeof(path), name);
+  int fd = open(path, O_RDONLY);
+  TEST_ASSERT(fd >= 0);
+  struct stat st;
+  TEST_ASSERT(fstat(fd, &st) == 0);
+  char *buffer = malloc((size_t)st.st_size);
+  TEST_ASSERT(buffer != NULL);
+  TEST_ASSERT(read(fd, buffer, (size_t)st.st_size) == st.st_size);
+  close(fd);
+  *size = (size_t)st.st_size;
+  return buffer;
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  size_t size1, size2;
+  char *version1 = image("version1", &size1);
+  char *version2 = image("version2", &size2);
+  int loaded = 0;
+  int fds = test_fds();
+  TEST_EQUAL(micro_module_init_mem(NULL, "version", version1, size1, NULL),
+             MICRO_MODULE_ERROR_IS_NULL);
+  TEST_EQUAL(micro_module_init_mem(&mm, "version", NULL, size1, NULL),
+             MICRO_MODULE_ERROR_ARG_NULL);
+
+  // The module is opened through the sealed memfd it keeps open
+  TEST_EQUAL(micro_module_init_mem(&mm, "version", version1, size1, &loaded),
+             MICRO_MODULE_OK);
+  MicroModuleEntry *module = micro_module_get(&mm, "version");
+  TEST_EQUAL(test_version(module), 1);
+  TEST_EQUAL(loaded, 1);
+  TEST_ASSERT(module->memfd > 0);
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", module->memfd);
+  TEST_ASSERT(strcmp(module->path, path) == 0);
+  int seals = fcntl(module->memfd, F_GET_SEALS);
+  TEST_ASSERT(seals >= 0 && (seals & F_SEAL_WRITE) && (seals & F_SEAL_SEAL));
+  TEST_EQUAL(test_fds(), fds + 1);
+  // The buffer may be reused right away
+  memset(version1, 0, size1);
+  TEST_EQUAL(test_version(module), 1);
+
+  // Reloads close the memfd of the replaced version
+  TEST_EQUAL(micro_module_init_mem(&mm, NULL, version2, size2, &loaded),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 2);
+  TEST_EQUAL(loaded, 1);
+  TEST_EQUAL(test_fds(), fds + 1);
+
+  // Images that are not modules fail without leaking their memfd
+  TEST_ASSERT(micro_module_init_mem(&mm, "zeros", version1, size1, NULL)
+              != MICRO_MODULE_OK);
+  TEST_EQUAL(test_fds(), fds + 1);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 2);
+
+  TEST_EQUAL(micro_module_exit(&mm, "version", &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  TEST_EQUAL(test_fds(), fds);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  free(version1);
+  free(version2);
+  return 0;
+}
@@ -0,0 +1,4 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "alpha"
+#include "module.h"
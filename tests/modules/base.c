@@ -0,0 +1,4 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "base"
+#include "module.h"
@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "broken"
+#define FAIL_INIT -1
+#include "module.h"
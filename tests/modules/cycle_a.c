@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "cycle_a"
+#define DEPS "cycle_b"
+#include "module.h"
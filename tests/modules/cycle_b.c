@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "cycle_b"
+#define DEPS "cycle_a"
+#include "module.h"
@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "delta"
+#define INDEPENDENT
+#include "module.h"
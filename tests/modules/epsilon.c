@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "epsilon"
+#define INDEPENDENT
+#include "module.h"
@@ -0,0 +1,4 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "gamma"
+#include "module.h"
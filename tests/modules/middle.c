@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "middle"
+#define DEPS "base"
+#include "module.h"
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+//
+// Body of the test modules. A module defines NAME, and optionally:
+// - VERSION, returned by version(), 1 by default
+// - DEPS, the comma separated names of the modules it depends on
+// - INDEPENDENT, to export micro_module_independent
+// - FAIL_INIT, an error its init function returns
+// - PROBE, for its argument to be a TestProbe instead of a counter
+// then includes this file.
+//
+// The init and exit functions count the instances of the modules
+// initialized and not exited yet in the int their argument points to,
+// if it is not NULL. Probing modules call the function of their
+// TestProbe instead, with their name and whether they are being
+// initialized. [active] tells if this very instance is
+// initialized, and [init_order] and [exit_order] hold the count
+// right after its init function incremented it and right before its
+// exit function decremented it.
+
+#include <stddef.h>
+
+#ifndef VERSION
+  #define VERSION 1
+#endif
+
+const char micro_module_name[] = NAME;
+
+#ifdef DEPS
+const char *micro_module_deps[] = { DEPS, NULL };
+#endif
+
+#ifdef PROBE
+// Same as TestProbe in tests/test.h
+typedef struct {
+  void (*fn)(const char *name, int initializing);
+} Probe;
+#endif
+
+#ifdef INDEPENDENT
+const int micro_module_independent = 1;
+#endif
+
+int active;
+int inits;
+int exits;
+int init_order;
+int exit_order;
+
+int version(void)
+{
+  return VERSION;
+}
+
+int micro_module_init(void *arg)
+{
+#ifdef FAIL_INIT
+  (void)arg;
+  return FAIL_INIT;
+#else
+#ifdef PROBE
+  if (arg) ((Probe*)arg)->fn(NAME, 1);
+#else
+  if (arg) init_order = __atomic_add_fetch((int*)arg, 1, __ATOMIC_SEQ_CST);
+#endif
+  inits++;
+  active = 1;
+  return 0;
+#endif
+}
+
+int micro_module_exit(void *arg)
+{
+  exits++;
+  active = 0;
+#ifdef PROBE
+  if (arg) ((Probe*)arg)->fn(NAME, 0);
+#else
+  if (arg) exit_order = __atomic_fetch_sub((int*)arg, 1, __ATOMIC_SEQ_CST);
+#endif
+  return 0;
+}
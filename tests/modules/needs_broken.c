@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "needs_broken"
+#define DEPS "broken"
+#include "module.h"
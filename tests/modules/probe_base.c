@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "probe_base"
+#define PROBE
+#include "module.h"
@@ -0,0 +1,6 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "probe_top"
+#define DEPS "probe_base"
+#define PROBE
+#include "module.h"
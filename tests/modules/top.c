@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "top"
+#define DEPS "middle", "base"
+#include "module.h"
@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "version"
+#define VERSION 1
+#include "module.h"
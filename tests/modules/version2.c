@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "version"
+#define VERSION 2
+#include "module.h"
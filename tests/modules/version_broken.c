@@ -0,0 +1,6 @@
+// SPDX-License-Identifier: MIT
+
+#define NAME "version"
+#define VERSION 3
+#define FAIL_INIT -1
+#include "module.h"
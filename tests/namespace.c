@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: MIT
+//
+// Placing modules in a pool of link-map namespaces
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static MicroModule mm;
+
+// Loads the test module [name], returning the error
+static int load(const char *name)
+{
+  char path[4096];
+  test_module(path, sizeof(path), name);
+  return micro_module_init(&mm, path, NULL);
+}
+
+// Returns the namespace the module called [name] was opened in
+static long lmid_of(const char *name)
+{
+  MicroModuleEntry *module = micro_module_get(&mm, name);
+  TEST_ASSERT(module != NULL);
+  Lmid_t lmid;
+  TEST_ASSERT(dlinfo(module->dlhandler, RTLD_DI_LMID, &lmid) == 0);
+  TEST_ASSERT(lmid != LM_ID_BASE);
+  return (long)lmid;
+}
+
+// Returns the number of modules opened in the namespaces of [mm]
+static size_t pooled(void)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < mm.namespaces_count; ++i)
+    count += mm.namespaces[i].modules;
+  return count;
+}
+
+// Puts every module in the isolation group [arg]
+static const char *grouped(const char *path, void *arg)
+{
+  (void)path;
+  return arg;
+}
+
+// Loads version1 from a file, replaces the file by version2 and loads
+// it again under [policy], and in the group [group] if not NULL
+static void replace(int policy, const char *group)
+{
+  char dir[256], file[4096], from[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  test_module(from, sizeof(from), "version1");
+  test_copy(from, file);
+  mm.namespace_policy = policy;
+  mm.group_fn  = group ? grouped : NULL;
+  mm.group_arg = (void*)group;
+
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  long before = lmid_of("version");
+  test_module(from, sizeof(from), "version2");
+  test_replace(from, file);
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  TEST_ASSERT(lmid_of("version") != before);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 2);
+  TEST_EQUAL(pooled(), 1);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  test_dir_remove(dir);
+  mm.group_fn  = NULL;
+  mm.group_arg = NULL;
+}
+
+int main(void)
+{
+  mm = micro_module_setup("micro_module_name",
+                          "micro_module_init",
+                          "micro_module_exit",
+                          true);
+
+  // Spread, each module gets a namespace while there is room
+  TEST_EQUAL(load("alpha"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("beta"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("gamma"), MICRO_MODULE_OK);
+  TEST_EQUAL(mm.namespaces_count, 3);
+  TEST_ASSERT(lmid_of("alpha") != lmid_of("beta"));
+  TEST_ASSERT(lmid_of("beta") != lmid_of("gamma"));
+  TEST_EQUAL(pooled(), 3);
+
+  // A reload goes to another namespace than the loaded copy, then
+  // the emptied one is reused
+  long before = lmid_of("alpha");
+  TEST_EQUAL(load("alpha"), MICRO_MODULE_OK);
+  TEST_ASSERT(lmid_of("alpha") != before);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "alpha"), "active"), 1);
+  TEST_EQUAL(mm.namespaces_count, 4);
+  TEST_EQUAL(pooled(), 3);
+  TEST_EQUAL(load("delta"), MICRO_MODULE_OK);
+  TEST_EQUAL(lmid_of("delta"), before);
+  TEST_EQUAL(mm.namespaces_count, 4);
+
+  // Namespaces are kept once their modules are unloaded
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(mm.namespaces_count, 4);
+  TEST_EQUAL(pooled(), 0);
+
+  // Exclusive, loading more modules than namespaces fails
+  mm.namespace_policy = MICRO_MODULE_NAMESPACE_EXCLUSIVE;
+  const char *names[] = {
+    "alpha", "beta", "gamma", "delta", "epsilon", "base", "version1",
+    "middle",
+  };
+  for (int i = 0; i < MICRO_MODULE_MAX_NAMESPACES; ++i)
+    TEST_EQUAL(load(names[i]), MICRO_MODULE_OK);
+  TEST_EQUAL(mm.namespaces_count, MICRO_MODULE_MAX_NAMESPACES);
+  for (size_t i = 0; i < mm.namespaces_count; ++i)
+    TEST_EQUAL(mm.namespaces[i].modules, 1);
+  TEST_EQUAL(load("top"), MICRO_MODULE_ERROR_NO_NAMESPACE);
+  TEST_ASSERT(micro_module_get(&mm, "top") == NULL);
+  TEST_EQUAL(pooled(), MICRO_MODULE_MAX_NAMESPACES);
+  TEST_EQUAL(micro_module_exit(&mm, "alpha", NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(load("top"), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+
+  // Shared, all the modules go to a single namespace
+  mm.namespace_policy = MICRO_MODULE_NAMESPACE_SHARED;
+  TEST_EQUAL(load("alpha"), MICRO_MODULE_OK);
+  TEST_EQUAL(load("beta"), MICRO_MODULE_OK);
+  TEST_EQUAL(lmid_of("alpha"), lmid_of("beta"));
+  TEST_EQUAL(pooled(), 2);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(pooled(), 0);
+  TEST_EQUAL(mm.namespaces_count, MICRO_MODULE_MAX_NAMESPACES);
+
+  // A file replaced while loaded is a new file at the same path, which
+  // glibc would still match to the loaded copy in its namespace
+  replace(MICRO_MODULE_NAMESPACE_SPREAD, NULL);
+  replace(MICRO_MODULE_NAMESPACE_EXCLUSIVE, NULL);
+  replace(MICRO_MODULE_NAMESPACE_SHARED, NULL);
+  replace(MICRO_MODULE_NAMESPACE_SHARED, "replaced");
+  return 0;
+}
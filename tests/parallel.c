@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: MIT
+//
+// Loading and unloading directories on many threads
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static int skipped;
+
+static void skip(const char *path, int error, void *arg)
+{
+  (void)arg;
+  TEST_ASSERT(strstr(path, "notes.txt") != NULL);
+  TEST_EQUAL(error, MICRO_MODULE_ERROR_NOT_A_MODULE);
+  skipped++;
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.independent_symbol = "micro_module_independent";
+  mm.skip_fn = skip;
+  char dir[256], path[4096];
+  int loaded = 0;
+
+  const char *names[] = { "alpha", "beta", "gamma", "delta", "epsilon" };
+  test_dir(dir, sizeof(dir));
+  for (int i = 0; i < 5; ++i)
+    test_install(dir, names[i]);
+  snprintf(path, sizeof(path), "%s/notes.txt", dir);
+  FILE *notes = fopen(path, "w");
+  TEST_ASSERT(notes != NULL);
+  fputs("not a module\n", notes);
+  fclose(notes);
+
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 4),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 5);
+  TEST_EQUAL(skipped, 1);
+  for (int i = 0; i < 5; ++i)
+  {
+    MicroModuleEntry *module = micro_module_get(&mm, names[i]);
+    TEST_EQUAL(test_int(module, "active"), 1);
+    TEST_EQUAL(test_int(module, "inits"), 1);
+    TEST_EQUAL(module->independent, i >= 3);
+  }
+
+  TEST_EQUAL(micro_module_exit_all_parallel(&mm, &loaded, 4),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  TEST_ASSERT(mm.modules == NULL);
+
+  // One thread per CPU, loading again what is already loaded
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 0),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 0),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 5);
+  TEST_EQUAL(mm.index->count, 5);
+  TEST_EQUAL(micro_module_exit_all_parallel(&mm, &loaded, 0),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+
+  // A failing init function is reported, the modules initialized
+  // before it stay loaded and its own is not registered
+  test_install(dir, "broken");
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 4), -1);
+  TEST_ASSERT(micro_module_get(&mm, "broken") == NULL);
+  int active = 0;
+  for (int i = 0; i < 5; ++i)
+  {
+    MicroModuleEntry *module = micro_module_get(&mm, names[i]);
+    if (module) active += test_int(module, "active");
+  }
+  TEST_EQUAL(loaded, active);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: MIT
+//
+// Loading, looking up and unloading modules through the hash index
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  char path[4096];
+  int loaded = 0;
+
+  const char *names[] = { "alpha", "beta", "gamma" };
+  for (int i = 0; i < 3; ++i)
+  {
+    test_module(path, sizeof(path), names[i]);
+    TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  }
+  TEST_EQUAL(loaded, 3);
+  TEST_EQUAL(mm.index->count, 3);
+  for (int i = 0; i < 3; ++i)
+  {
+    MicroModuleEntry *module = micro_module_get(&mm, names[i]);
+    TEST_ASSERT(module != NULL);
+    TEST_ASSERT(strcmp(module->name, names[i]) == 0);
+    TEST_EQUAL(test_int(module, "active"), 1);
+  }
+  TEST_ASSERT(micro_module_get(&mm, "delta") == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "alph") == NULL);
+
+  // Reloading replaces the entry instead of adding one
+  test_module(path, sizeof(path), "beta");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 3);
+  TEST_EQUAL(mm.index->count, 3);
+
+  TEST_EQUAL(micro_module_exit(&mm, "beta", &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 2);
+  TEST_ASSERT(micro_module_get(&mm, "beta") == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") != NULL);
+  TEST_ASSERT(micro_module_get(&mm, "gamma") != NULL);
+  TEST_EQUAL(micro_module_exit(&mm, "beta", &loaded),
+             MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED);
+
+  // A module failing to initialize is not registered
+  test_module(path, sizeof(path), "broken");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), -1);
+  TEST_ASSERT(micro_module_get(&mm, "broken") == NULL);
+  TEST_EQUAL(mm.index->count, 2);
+
+  // Grow the index past its initial capacity, through tombstones and
+  // names longer than what is stored inline, sharing their prefix
+  char name[128];
+  for (int i = 0; i < 200; ++i)
+  {
+    snprintf(name, sizeof(name), "%0*d", MICRO_MODULE_NAME_INLINE + 8, i);
+    TEST_EQUAL(micro_module_init_lazy(&mm, path, name, NULL), MICRO_MODULE_OK);
+    if (i % 3 == 0)
+      TEST_EQUAL(micro_module_exit(&mm, name, NULL), MICRO_MODULE_OK);
+  }
+  TEST_EQUAL(mm.index->count, 2 + 200 - 67);
+  for (int i = 0; i < 200; ++i)
+  {
+    snprintf(name, sizeof(name), "%0*d", MICRO_MODULE_NAME_INLINE + 8, i);
+    TEST_EQUAL(micro_module_exit(&mm, name, NULL),
+               i % 3 == 0 ? MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED
+                          : MICRO_MODULE_OK);
+  }
+  TEST_EQUAL(mm.index->count, 2);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") != NULL);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  TEST_ASSERT(mm.modules == NULL && mm.index == NULL);
+  return 0;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: MIT
+//
+// Loading snapshots of files, so that in-place overwrites reload
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  char dir[256], path[4096], file[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  int loaded = 0;
+  int fds = test_fds();
+
+  // Snapshots load what the file holds, keeping its path, and can be
+  // overwritten in place while loaded
+  mm.shadow_copy = true;
+  test_module(path, sizeof(path), "version1");
+  test_copy(path, file);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  MicroModuleEntry *module = micro_module_get(&mm, "version");
+  TEST_EQUAL(test_version(module), 1);
+  TEST_ASSERT(strcmp(module->path, file) == 0);
+  TEST_ASSERT(module->memfd > 0);
+  TEST_EQUAL(test_fds(), fds + 1);
+  for (int i = 0; i < 4; ++i)
+  {
+    test_module(path, sizeof(path), i % 2 ? "version1" : "version2");
+    test_copy(path, file);
+    TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+    TEST_EQUAL(test_version(micro_module_get(&mm, "version")), i % 2 ? 1 : 2);
+    TEST_EQUAL(loaded, 1);
+    TEST_EQUAL(test_fds(), fds + 1);
+  }
+
+  // The snapshot does not change with the file
+  test_module(path, sizeof(path), "version2");
+  test_copy(path, file);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 1);
+
+  // Files that are not modules fail without leaking their snapshot
+  FILE *notes = fopen(file, "w");
+  TEST_ASSERT(notes && fputs("not a module\n", notes) >= 0);
+  fclose(notes);
+  TEST_ASSERT(micro_module_init(&mm, file, &loaded) != MICRO_MODULE_OK);
+  TEST_EQUAL(test_fds(), fds + 1);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 1);
+  TEST_ASSERT(unlink(file) == 0);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded),
+             MICRO_MODULE_ERROR_OPENING_MODULE);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  TEST_EQUAL(test_fds(), fds);
+
+  // So do the modules of a directory, also when taken from the
+  // manifest
+  char manifest[4096];
+  snprintf(manifest, sizeof(manifest), "%s.manifest", dir);
+  mm.manifest_path = manifest;
+  test_module(path, sizeof(path), "version1");
+  test_copy(path, file);
+  for (int i = 0; i < 3; ++i)
+  {
+    if (i == 2)
+    {
+      test_module(path, sizeof(path), "version2");
+      test_copy(path, file);
+    }
+    TEST_EQUAL(micro_module_init_all(&mm, dir, &loaded), MICRO_MODULE_OK);
+    module = micro_module_get(&mm, "version");
+    TEST_EQUAL(test_version(module), i == 2 ? 2 : 1);
+    TEST_ASSERT(strcmp(module->path, file) == 0);
+    TEST_ASSERT(module->memfd > 0);
+    TEST_EQUAL(loaded, 1);
+    TEST_EQUAL(test_fds(), fds + 1);
+  }
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  mm.manifest_path = NULL;
+  TEST_ASSERT(unlink(manifest) == 0);
+
+  // And the lazy modules
+  test_module(path, sizeof(path), "version1");
+  test_copy(path, file);
+  for (int i = 0; i < 2; ++i)
+  {
+    if (i == 1)
+    {
+      test_module(path, sizeof(path), "version2");
+      test_copy(path, file);
+    }
+    TEST_EQUAL(micro_module_init_lazy(&mm, file, NULL, &loaded),
+               MICRO_MODULE_OK);
+    module = micro_module_get(&mm, "version");
+    TEST_EQUAL(test_version(module), i + 1);
+    TEST_ASSERT(strcmp(module->path, file) == 0);
+    TEST_ASSERT(module->memfd > 0);
+    TEST_EQUAL(loaded, 1);
+    TEST_EQUAL(test_fds(), fds + 1);
+  }
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  TEST_EQUAL(test_fds(), fds);
+  test_dir_remove(dir);
+  return 0;
+}
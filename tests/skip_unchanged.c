@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT
+//
+// Skipping the reloads of modules whose file did not change
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.shadow_copy = true;
+  char dir[256], path[4096], file[4096], copy[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/alpha.so", dir);
+  snprintf(copy, sizeof(copy), "%s/copy.so", dir);
+  test_module(path, sizeof(path), "alpha");
+  test_copy(path, file);
+  int loaded = 0;
+
+  // Modules are reloaded by default, even if nothing changed
+  TEST_ASSERT(!mm.skip_unchanged);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  void *dlhandler = micro_module_get(&mm, "alpha")->dlhandler;
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "alpha")->dlhandler != dlhandler);
+  TEST_EQUAL(loaded, 1);
+
+  // Or left alone if asked to
+  mm.skip_unchanged = true;
+  MicroModuleEntry *module = micro_module_get(&mm, "alpha");
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == module);
+
+  // A new file with the same build-id is still the same module, whose
+  // identity follows the file
+  test_replace(path, file);
+  struct stat st;
+  TEST_ASSERT(stat(file, &st) == 0);
+  TEST_ASSERT(module->file_id.ino != st.st_ino);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == module);
+  TEST_EQUAL(module->file_id.ino, st.st_ino);
+  mm.check_files = false;
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == module);
+  mm.check_files = true;
+
+  // The same file under another path is loaded from there, leaving
+  // the other modules as they are
+  test_module(path, sizeof(path), "beta");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  MicroModuleEntry *beta = micro_module_get(&mm, "beta");
+  MicroModuleFileId beta_id = beta->file_id;
+  test_module(path, sizeof(path), "alpha");
+  test_copy(path, copy);
+  TEST_EQUAL(micro_module_init(&mm, copy, &loaded), MICRO_MODULE_OK);
+  module = micro_module_get(&mm, "alpha");
+  TEST_ASSERT(strcmp(module->path, copy) == 0);
+  TEST_ASSERT(micro_module_get(&mm, "beta") == beta);
+  TEST_ASSERT(memcmp(&beta->file_id, &beta_id, sizeof(beta_id)) == 0);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(strcmp(micro_module_get(&mm, "alpha")->path, file) == 0);
+  TEST_EQUAL(loaded, 2);
+
+  // Files that changed are reloaded
+  test_module(path, sizeof(path), "version1");
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  test_copy(path, file);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  test_module(path, sizeof(path), "version2");
+  test_copy(path, file);
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 2);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  test_dir_remove(dir);
+  return 0;
+}
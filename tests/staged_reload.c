@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+//
+// Reloading modules by initializing the new version first
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+// Replaces [file] by the test module [name]
+static void deploy(const char *file, const char *name)
+{
+  char from[4096];
+  test_module(from, sizeof(from), name);
+  test_replace(from, file);
+}
+
+// Calls version() through [stub]
+static int stub_version(MicroModuleStub *stub)
+{
+  int (*fn)(void);
+  *(void**)(&fn) = MICRO_MODULE_STUB_ADDRESS(stub);
+  TEST_ASSERT(fn != NULL);
+  return fn();
+}
+
+// Reloads a new version of a module, and then one that fails to
+// initialize, where dlmopen gives distinct instances
+static void staged(bool use_new_namespace, bool shadow_copy)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       use_new_namespace);
+  mm.staged_reload = true;
+  mm.shadow_copy = shadow_copy;
+  char dir[256], file[4096];
+  int loaded = 0;
+
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  deploy(file, "version1");
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  MicroModuleStub *version = micro_module_stub(&mm, "version", "version");
+  TEST_ASSERT(version != NULL);
+
+  // The new version initializes while the old one is still counted
+  deploy(file, "version2");
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), MICRO_MODULE_OK);
+  MicroModuleEntry *module = micro_module_get(&mm, "version");
+  TEST_EQUAL(test_version(module), 2);
+  TEST_EQUAL(test_int(module, "init_order"), 2);
+  TEST_EQUAL(test_int(module, "active"), 1);
+  TEST_EQUAL(loaded, 1);
+  TEST_EQUAL(mm.index->count, 1);
+  TEST_EQUAL(stub_version(version), 2);
+
+  // A version failing to initialize leaves the old one in place
+  deploy(file, "version_broken");
+  TEST_EQUAL(micro_module_init(&mm, file, &loaded), -1);
+  TEST_ASSERT(micro_module_get(&mm, "version") == module);
+  TEST_EQUAL(test_version(module), 2);
+  TEST_EQUAL(test_int(module, "active"), 1);
+  TEST_EQUAL(loaded, 1);
+  TEST_EQUAL(stub_version(version), 2);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  micro_module_free_stubs(&mm);
+  test_dir_remove(dir);
+}
+
+int main(void)
+{
+  staged(true, false);
+  staged(false, true);
+
+  // In the main namespace, dlmopen hands back the loaded instance of
+  // a path, which is then reloaded in place rather than staged
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.staged_reload = true;
+  char path[4096];
+  int loaded = 0;
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  MicroModuleEntry *module = micro_module_get(&mm, "alpha");
+  TEST_EQUAL(test_int(module, "active"), 1);
+  TEST_EQUAL(test_int(module, "inits"), 2);
+  TEST_EQUAL(test_int(module, "exits"), 1);
+  TEST_EQUAL(loaded, 1);
+
+  // Staged reloads of other modules still go through
+  test_module(path, sizeof(path), "beta");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 2);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  return 0;
+}
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT
+//
+// Timing the phases of loading and unloading modules
+
+#define MICRO_MODULE_STATS
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+// Checks that [phase] was timed [count] times, consistently
+static void test_phase(const MicroModulePhaseStats *phase, uint64_t count)
+{
+  TEST_EQUAL(phase->count, count);
+  if (count == 0) return;
+  TEST_ASSERT(phase->min_ns <= phase->last_ns);
+  TEST_ASSERT(phase->last_ns <= phase->max_ns);
+  TEST_ASSERT(phase->max_ns <= phase->total_ns);
+  TEST_ASSERT(phase->total_ns <= phase->max_ns * count);
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.shadow_copy = true;
+  MicroModuleStats stats;
+  TEST_EQUAL(micro_module_stats(NULL, NULL, &stats),
+             MICRO_MODULE_ERROR_IS_NULL);
+  TEST_EQUAL(micro_module_stats(&mm, NULL, NULL),
+             MICRO_MODULE_ERROR_ARG_NULL);
+  TEST_EQUAL(micro_module_stats(&mm, "version", &stats),
+             MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED);
+
+  // Each phase of a load is timed for the module and the totals
+  char dir[256], path[4096], file[4096];
+  test_dir(dir, sizeof(dir));
+  test_module(path, sizeof(path), "version1");
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  test_copy(path, file);
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_stats(&mm, "version", &stats), MICRO_MODULE_OK);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_OPEN], 1);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_SYMBOLS], 1);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_INIT], 1);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_EXIT], 0);
+  TEST_EQUAL(stats.loads, 1);
+  TEST_EQUAL(stats.reloads, 0);
+
+  // Reloads carry the statistics of the replaced module over
+  test_module(path, sizeof(path), "version2");
+  test_replace(path, file);
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_stats(&mm, "version", &stats), MICRO_MODULE_OK);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_OPEN], 2);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_INIT], 2);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_EXIT], 1);
+  TEST_EQUAL(stats.loads, 2);
+  TEST_EQUAL(stats.reloads, 1);
+
+  // Directory scans and failed loads only count in the totals
+  test_install(dir, "beta");
+  test_install(dir, "broken");
+  TEST_ASSERT(micro_module_init_all(&mm, dir, NULL) != MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_stats(&mm, NULL, &stats), MICRO_MODULE_OK);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_SCAN], 1);
+  TEST_ASSERT(stats.phases[MICRO_MODULE_PHASE_INIT].count >= 4);
+  TEST_ASSERT(stats.loads >= 3);
+  TEST_EQUAL(micro_module_stats(&mm, "beta", &stats), MICRO_MODULE_OK);
+  TEST_EQUAL(stats.loads, 1);
+
+  // Unloads are timed until the modules are gone
+  TEST_EQUAL(micro_module_exit(&mm, "beta", NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_stats(&mm, "beta", &stats),
+             MICRO_MODULE_ERROR_MODULE_NOT_REGISTERED);
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_stats(&mm, NULL, &stats), MICRO_MODULE_OK);
+  TEST_ASSERT(stats.unloads >= 2);
+  TEST_ASSERT(stats.phases[MICRO_MODULE_PHASE_EXIT].count >= 3);
+  TEST_ASSERT(stats.phases[MICRO_MODULE_PHASE_CLOSE].count >= 3);
+
+  micro_module_stats_reset(&mm);
+  TEST_EQUAL(micro_module_stats(&mm, NULL, &stats), MICRO_MODULE_OK);
+  TEST_EQUAL(stats.loads, 0);
+  test_phase(&stats.phases[MICRO_MODULE_PHASE_OPEN], 0);
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: MIT
+//
+// Calling modules through stubs that follow their reloads
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+// Returns what the function behind [stub] returns, 0 if it is unset
+static int stub_call(MicroModuleStub *stub)
+{
+  int (*fn)(void);
+  *(void**)(&fn) = MICRO_MODULE_STUB_ADDRESS(stub);
+  return fn ? fn() : 0;
+}
+
+// Replaces [file] by the test module [name]
+static void deploy(const char *file, const char *name)
+{
+  char from[4096];
+  test_module(from, sizeof(from), name);
+  test_replace(from, file);
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.shadow_copy = true;
+  char dir[256], file[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(file, sizeof(file), "%s/version.so", dir);
+  TEST_ASSERT(micro_module_stub(NULL, "version", "version") == NULL);
+  TEST_ASSERT(micro_module_stub(&mm, NULL, "version") == NULL);
+
+  // Stubs of modules not loaded yet are set once they are
+  MicroModuleStub *version = micro_module_stub(&mm, "version", "version");
+  TEST_ASSERT(version != NULL);
+  TEST_ASSERT(micro_module_stub(&mm, "version", "version") == version);
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(version) == NULL);
+  deploy(file, "version1");
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(stub_call(version), 1);
+
+  // Stubs created after the load start set, stubs of missing symbols
+  // stay unset
+  MicroModuleStub *active = micro_module_stub(&mm, "version", "active");
+  TEST_ASSERT(active != version);
+  TEST_EQUAL(*(int*)MICRO_MODULE_STUB_ADDRESS(active), 1);
+  MicroModuleStub *missing = micro_module_stub(&mm, "version", "missing");
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(missing) == NULL);
+
+  // Reloads retarget them, in place or staged
+  deploy(file, "version2");
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(stub_call(version), 2);
+  TEST_EQUAL(*(int*)MICRO_MODULE_STUB_ADDRESS(active), 1);
+  mm.staged_reload = true;
+  deploy(file, "version1");
+  TEST_EQUAL(micro_module_init(&mm, file, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(stub_call(version), 1);
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(version)
+              == dlsym(micro_module_get(&mm, "version")->dlhandler,
+                       "version"));
+
+  // They are unset when the module is exited, and set again when a
+  // lazy module is loaded on first use
+  TEST_EQUAL(micro_module_exit(&mm, "version", NULL), MICRO_MODULE_OK);
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(version) == NULL);
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(active) == NULL);
+  deploy(file, "version2");
+  TEST_EQUAL(micro_module_init_lazy(&mm, file, "version", NULL),
+             MICRO_MODULE_OK);
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(version) == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "version") != NULL);
+  TEST_EQUAL(stub_call(version), 2);
+
+  // Other modules do not touch them
+  char path[4096];
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init(&mm, path, NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_exit(&mm, "alpha", NULL), MICRO_MODULE_OK);
+  TEST_EQUAL(stub_call(version), 2);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  TEST_ASSERT(MICRO_MODULE_STUB_ADDRESS(version) == NULL);
+  micro_module_free_stubs(&mm);
+  TEST_ASSERT(mm.stubs == NULL);
+  test_dir_remove(dir);
+  return 0;
+}
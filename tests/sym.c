@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+//
+// Looking symbols up through the cache of a module
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static const char *symbols[] = {
+  "micro_module_name", "micro_module_init", "micro_module_exit",
+  "active", "inits", "exits", "init_order", "exit_order", "version",
+};
+#define SYMBOLS (sizeof(symbols) / sizeof(symbols[0]))
+
+static MicroModule mm;
+
+// Looks all the symbols of the module up, along with missing ones
+static void *lookup(void *arg)
+{
+  MicroModuleEntry *module = arg;
+  char missing[32];
+  for (int round = 0; round < 100; ++round)
+  {
+    for (size_t i = 0; i < SYMBOLS; ++i)
+      TEST_ASSERT(micro_module_sym(&mm, module, symbols[i])
+                  == dlsym(module->dlhandler, symbols[i]));
+    for (int i = 0; i < 16; ++i)
+    {
+      snprintf(missing, sizeof(missing), "missing_%d", i);
+      TEST_ASSERT(micro_module_sym(&mm, module, missing) == NULL);
+    }
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  mm = micro_module_setup("micro_module_name",
+                          "micro_module_init",
+                          "micro_module_exit",
+                          false);
+  char path[4096];
+
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init(&mm, path, NULL), MICRO_MODULE_OK);
+  MicroModuleEntry *module = micro_module_get(&mm, "alpha");
+  TEST_ASSERT(micro_module_sym(NULL, module, "active") == NULL);
+  TEST_ASSERT(micro_module_sym(&mm, NULL, "active") == NULL);
+  TEST_ASSERT(micro_module_sym(&mm, module, NULL) == NULL);
+
+  // The cache grows past its initial capacity while being read
+  TEST_ASSERT(module->syms == NULL);
+  pthread_t threads[4];
+  for (int i = 0; i < 4; ++i)
+    TEST_ASSERT(pthread_create(&threads[i], NULL, lookup, module) == 0);
+  for (int i = 0; i < 4; ++i)
+    pthread_join(threads[i], NULL);
+  TEST_EQUAL(module->syms->count, SYMBOLS + 16);
+  TEST_ASSERT(module->syms->capacity > MICRO_MODULE_SYM_CAPACITY);
+
+  int *active = micro_module_sym(&mm, module, "active");
+  TEST_EQUAL(*active, 1);
+
+  // Lazy modules are not looked up until loaded, reloads start over
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, "lazy", NULL),
+             MICRO_MODULE_OK);
+  MicroModuleEntry *lazy = &mm.modules->module;
+  TEST_ASSERT(micro_module_sym(&mm, lazy, "active") == NULL);
+  TEST_EQUAL(micro_module_init(&mm, path, NULL), MICRO_MODULE_OK);
+  module = micro_module_get(&mm, "alpha");
+  TEST_ASSERT(module->syms == NULL);
+  TEST_ASSERT(micro_module_sym(&mm, module, "version") != NULL);
+  TEST_EQUAL(module->syms->count, 1);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, NULL), MICRO_MODULE_OK);
+  return 0;
+}
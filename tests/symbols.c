@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+//
+// Resolving a table of symbols when modules are loaded
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+enum { VERSION, ACTIVE, MISSING };
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  MicroModuleSymbol symbols[] = {
+    [VERSION] = { "version", true },
+    [ACTIVE]  = { "active", true },
+    [MISSING] = { "missing", false },
+  };
+  mm.symbols       = symbols;
+  mm.symbols_count = 3;
+  char dir[256], path[4096];
+  int loaded = 0;
+
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  MicroModuleEntry *module = micro_module_get(&mm, "alpha");
+  TEST_ASSERT(module->fns != NULL);
+  TEST_ASSERT(module->fns[VERSION] == dlsym(module->dlhandler, "version"));
+  TEST_EQUAL(*(int*)module->fns[ACTIVE], 1);
+  TEST_ASSERT(module->fns[MISSING] == NULL);
+  int (*version)(void);
+  *(void**)(&version) = module->fns[VERSION];
+  TEST_EQUAL(version(), 1);
+
+  // Lazy modules and directories resolve them too
+  test_module(path, sizeof(path), "beta");
+  TEST_EQUAL(micro_module_init_lazy(&mm, path, NULL, &loaded),
+             MICRO_MODULE_OK);
+  module = micro_module_get(&mm, "beta");
+  TEST_ASSERT(module->fns && module->fns[VERSION] != NULL);
+  test_dir(dir, sizeof(dir));
+  test_install(dir, "gamma");
+  TEST_EQUAL(micro_module_init_all(&mm, dir, &loaded), MICRO_MODULE_OK);
+  module = micro_module_get(&mm, "gamma");
+  TEST_ASSERT(module->fns && *(int*)module->fns[ACTIVE] == 1);
+  TEST_EQUAL(loaded, 3);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+
+  // A missing required symbol fails the load, whether the file is
+  // checked or not
+  symbols[MISSING].required = true;
+  test_module(path, sizeof(path), "alpha");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded),
+             MICRO_MODULE_ERROR_LOCATING_SYMBOL);
+  mm.check_files = false;
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded),
+             MICRO_MODULE_ERROR_LOCATING_SYMBOL);
+  TEST_EQUAL(loaded, 0);
+  TEST_ASSERT(mm.modules == NULL);
+
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+//
+// Applying only what changed in a directory
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+static int changes[3];
+static char last_name[64];
+static int skipped;
+
+static void change(const char *path, const char *module_name, int kind,
+                   void *arg)
+{
+  (void)arg;
+  TEST_ASSERT(path != NULL && module_name != NULL);
+  TEST_ASSERT(kind >= 0 && kind < 3);
+  changes[kind]++;
+  snprintf(last_name, sizeof(last_name), "%s", module_name);
+}
+
+static void skip(const char *path, int error, void *arg)
+{
+  (void)arg;
+  TEST_ASSERT(strstr(path, "notes.txt") != NULL);
+  TEST_EQUAL(error, MICRO_MODULE_ERROR_NOT_A_MODULE);
+  skipped++;
+}
+
+// Checks the counts of [report]
+static void test_report(const MicroModuleSyncReport *report, size_t added,
+                        size_t reloaded, size_t removed, size_t unchanged,
+                        size_t failed)
+{
+  TEST_EQUAL(report->added, added);
+  TEST_EQUAL(report->reloaded, reloaded);
+  TEST_EQUAL(report->removed, removed);
+  TEST_EQUAL(report->unchanged, unchanged);
+  TEST_EQUAL(report->failed, failed);
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.change_fn = change;
+  mm.skip_fn   = skip;
+  // Files replaced under the same path load as new instances
+  mm.shadow_copy = true;
+  char dir[256], path[4096], version[4096], other[4096];
+  test_dir(dir, sizeof(dir));
+  snprintf(version, sizeof(version), "%s/version.so", dir);
+  int loaded = 0;
+  MicroModuleSyncReport report;
+
+  // New files are loaded
+  test_install(dir, "alpha");
+  test_module(path, sizeof(path), "version1");
+  test_copy(path, version);
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  test_report(&report, 2, 0, 0, 0, 0);
+  TEST_EQUAL(changes[MICRO_MODULE_CHANGE_ADDED], 2);
+  TEST_EQUAL(loaded, 2);
+
+  // Nothing happens until something changes
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  test_report(&report, 0, 0, 0, 2, 0);
+  TEST_EQUAL(changes[MICRO_MODULE_CHANGE_RELOADED], 0);
+
+  // A new file is reloaded, unless it has the same build-id
+  test_module(path, sizeof(path), "version2");
+  test_replace(path, version);
+  snprintf(other, sizeof(other), "%s/alpha.so", dir);
+  test_module(path, sizeof(path), "alpha");
+  test_replace(path, other);
+  MicroModuleEntry *alpha = micro_module_get(&mm, "alpha");
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  test_report(&report, 0, 1, 0, 1, 0);
+  TEST_EQUAL(changes[MICRO_MODULE_CHANGE_RELOADED], 1);
+  TEST_ASSERT(strcmp(last_name, "version") == 0);
+  TEST_EQUAL(test_version(micro_module_get(&mm, "version")), 2);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == alpha);
+  TEST_EQUAL(loaded, 2);
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  test_report(&report, 0, 0, 0, 2, 0);
+
+  // Removed files are unloaded, other files fail, and the modules of
+  // other directories are left alone
+  test_module(path, sizeof(path), "beta");
+  TEST_EQUAL(micro_module_init(&mm, path, &loaded), MICRO_MODULE_OK);
+  TEST_ASSERT(unlink(other) == 0);
+  snprintf(other, sizeof(other), "%s/notes.txt", dir);
+  FILE *notes = fopen(other, "w");
+  TEST_ASSERT(notes && fputs("not a module\n", notes) >= 0);
+  fclose(notes);
+  TEST_EQUAL(micro_module_sync(&mm, dir, &loaded, &report), MICRO_MODULE_OK);
+  test_report(&report, 0, 0, 1, 1, 1);
+  TEST_EQUAL(changes[MICRO_MODULE_CHANGE_REMOVED], 1);
+  TEST_ASSERT(strcmp(last_name, "alpha") == 0);
+  TEST_EQUAL(skipped, 1);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == NULL);
+  TEST_ASSERT(micro_module_get(&mm, "beta") != NULL);
+  TEST_EQUAL(loaded, 2);
+
+  // A directory that went away unloads nothing
+  TEST_EQUAL(micro_module_sync(&mm, TEST_MODULES "/missing", &loaded,
+                               &report),
+             MICRO_MODULE_ERROR_OPEN_MODULES_DIR);
+  TEST_EQUAL(loaded, 2);
+
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MIT
+//
+// Helpers shared by the tests. Each test is a program that includes
+// micro-module.h with MICRO_MODULE_IMPLEMENTATION, then this file, and
+// is run from the root of the repository by `make test`. The modules
+// built from tests/modules are in TEST_MODULES.
+
+#ifndef MICRO_MODULE_TEST_H
+#define MICRO_MODULE_TEST_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_MODULES "tests/build/modules"
+
+// Fails the test if [cond] does not hold
+#define TEST_ASSERT(cond)                                               \
+  do {                                                                  \
+    if (!(cond))                                                        \
+    {                                                                   \
+      fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+// Fails the test if the integers [a] and [b] differ
+#define TEST_EQUAL(a, b)                                                \
+  do {                                                                  \
+    long long test_a = (long long)(a), test_b = (long long)(b);         \
+    if (test_a != test_b)                                               \
+    {                                                                   \
+      fprintf(stderr, "%s:%d: failed: %s == %s (%lld != %lld)\n",       \
+              __FILE__, __LINE__, #a, #b, test_a, test_b);              \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+// What the argument of the init and exit functions of the probing
+// test modules points to, see tests/modules/module.h
+typedef struct {
+  void (*fn)(const char *name, int initializing);
+} TestProbe;
+
+// Writes the path of the test module [name] into [path]
+static inline void test_module(char *path, size_t size, const char *name)
+{
+  snprintf(path, size, TEST_MODULES "/%s.so", name);
+}
+
+// Copies the file [from] over [to], keeping the inode of [to] if it
+// exists
+static inline void test_copy(const char *from, const char *to)
+{
+  int in = open(from, O_RDONLY);
+  int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  TEST_ASSERT(in >= 0 && out >= 0);
+  char buffer[65536];
+  ssize_t n;
+  while ((n = read(in, buffer, sizeof(buffer))) > 0)
+    TEST_ASSERT(write(out, buffer, (size_t)n) == n);
+  TEST_ASSERT(n == 0);
+  close(in);
+  TEST_ASSERT(close(out) == 0);
+}
+
+// Copies the file [from] to a new inode renamed over [to], the way
+// files are deployed atomically
+static inline void test_replace(const char *from, const char *to)
+{
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", to);
+  test_copy(from, tmp);
+  TEST_ASSERT(rename(tmp, to) == 0);
+}
+
+// Copies the test module [name] into the directory [dir]
+static inline void test_install(const char *dir, const char *name)
+{
+  char from[4096], to[4096];
+  test_module(from, sizeof(from), name);
+  snprintf(to, sizeof(to), "%s/%s.so", dir, name);
+  test_copy(from, to);
+}
+
+// Creates a new empty directory, whose path is written to [dir]
+static inline void test_dir(char *dir, size_t size)
+{
+  snprintf(dir, size, "/tmp/micro-module-test-XXXXXX");
+  TEST_ASSERT(mkdtemp(dir) != NULL);
+}
+
+// Removes the directory [dir] created by test_dir and its files
+static inline void test_dir_remove(const char *dir)
+{
+  DIR *d = opendir(dir);
+  TEST_ASSERT(d != NULL);
+  struct dirent *entry;
+  char path[4096];
+  while ((entry = readdir(d)))
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    TEST_ASSERT(unlink(path) == 0);
+  }
+  closedir(d);
+  TEST_ASSERT(rmdir(dir) == 0);
+}
+
+// Returns the number of open file descriptors, to find leaks
+static inline int test_fds(void)
+{
+  DIR *d = opendir("/proc/self/fd");
+  TEST_ASSERT(d != NULL);
+  int count = 0;
+  while (readdir(d))
+    count++;
+  closedir(d);
+  return count;
+}
+
+// Returns the integer [symbol] of the loaded [module]
+static inline int test_int(MicroModuleEntry *module, const char *symbol)
+{
+  TEST_ASSERT(module != NULL);
+  int *value = dlsym(module->dlhandler, symbol);
+  TEST_ASSERT(value != NULL);
+  return *value;
+}
+
+// Returns what the function version() of the loaded [module] returns
+static inline int test_version(MicroModuleEntry *module)
+{
+  TEST_ASSERT(module != NULL);
+  int (*fn)(void);
+  *(void**)(&fn) = dlsym(module->dlhandler, "version");
+  TEST_ASSERT(fn != NULL);
+  return fn();
+}
+
+#endif // MICRO_MODULE_TEST_H
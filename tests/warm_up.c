@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+//
+// Reading module files ahead before opening them
+
+#define MICRO_MODULE_STATS
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+// Returns how many times the files were read ahead since the last call
+static uint64_t warm_ups(MicroModule *mm)
+{
+  MicroModuleStats stats;
+  TEST_EQUAL(micro_module_stats(mm, NULL, &stats), MICRO_MODULE_OK);
+  micro_module_stats_reset(mm);
+  return stats.phases[MICRO_MODULE_PHASE_WARM_UP].count;
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  TEST_ASSERT(mm.warm_up);
+  char dir[256], bundle[4096];
+  test_dir(dir, sizeof(dir));
+  const char *names[] = { "alpha", "beta", "gamma", "delta", "epsilon" };
+  for (int i = 0; i < 5; ++i)
+    test_install(dir, names[i]);
+  int loaded = 0;
+
+  // The files are read ahead once, whatever the number of threads,
+  // and load the same with or without it
+  for (unsigned int threads = 1; threads <= 8; threads *= 2)
+  {
+    TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, threads),
+               MICRO_MODULE_OK);
+    TEST_EQUAL(loaded, 5);
+    TEST_EQUAL(warm_ups(&mm), 1);
+    TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  }
+  mm.warm_up = false;
+  TEST_EQUAL(micro_module_init_all_parallel(&mm, dir, &loaded, 4),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 5);
+  TEST_EQUAL(warm_ups(&mm), 0);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+
+  // Empty directories have nothing to read ahead
+  mm.warm_up = true;
+  char empty[256];
+  test_dir(empty, sizeof(empty));
+  TEST_EQUAL(micro_module_init_all(&mm, empty, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(warm_ups(&mm), 0);
+  test_dir_remove(empty);
+
+  // Bundles are read ahead whole
+  char files[5][4096];
+  const char *paths[5];
+  for (int i = 0; i < 5; ++i)
+  {
+    test_module(files[i], sizeof(files[i]), names[i]);
+    paths[i] = files[i];
+  }
+  snprintf(bundle, sizeof(bundle), "%s/modules.bundle", dir);
+  TEST_EQUAL(micro_module_write_bundle(&mm, bundle, paths, 5),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(micro_module_init_bundle(&mm, bundle, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 5);
+  TEST_EQUAL(warm_ups(&mm), 1);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+
+  test_dir_remove(dir);
+  return 0;
+}
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: MIT
+//
+// Watching a directory and applying its changes
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+#include "test.h"
+
+#include <poll.h>
+
+static int skipped;
+
+static void skip(const char *path, int error, void *arg)
+{
+  (void)arg;
+  TEST_ASSERT(strstr(path, "notes.txt") != NULL);
+  TEST_EQUAL(error, MICRO_MODULE_ERROR_NOT_A_MODULE);
+  skipped++;
+}
+
+// Dispatches the events of [watch] until nothing happened for a while.
+// Returns the number of files applied.
+static int settle(MicroModuleWatch *watch)
+{
+  int applied = 0;
+  struct pollfd fd = { .fd = watch->fd, .events = POLLIN };
+  while (poll(&fd, 1, 300) > 0)
+  {
+    int result = micro_module_watch_dispatch(watch);
+    TEST_ASSERT(result >= 0);
+    applied += result;
+  }
+  return applied;
+}
+
+int main(void)
+{
+  MicroModule mm =
+    micro_module_setup("micro_module_name",
+                       "micro_module_init",
+                       "micro_module_exit",
+                       false);
+  mm.skip_fn = skip;
+  // Files replaced under the same path load as new instances
+  mm.shadow_copy = true;
+  char dir[256], path[4096];
+  int loaded = 0;
+  MicroModuleWatch watch;
+
+  test_dir(dir, sizeof(dir));
+  TEST_EQUAL(micro_module_watch(&mm, &watch, TEST_MODULES "/missing",
+                                &loaded, 20),
+             MICRO_MODULE_ERROR_WATCHING_MODULES_DIR);
+  TEST_EQUAL(micro_module_watch(&mm, &watch, dir, &loaded, 20),
+             MICRO_MODULE_OK);
+  TEST_EQUAL(settle(&watch), 0);
+
+  // Files written are loaded once the burst is over
+  test_install(dir, "alpha");
+  TEST_EQUAL(settle(&watch), 1);
+  TEST_EQUAL(loaded, 1);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "alpha"), "active"), 1);
+
+  test_install(dir, "beta");
+  test_install(dir, "gamma");
+  test_install(dir, "gamma");
+  TEST_EQUAL(settle(&watch), 2);
+  TEST_EQUAL(loaded, 3);
+
+  // Files replaced are reloaded, moved away or deleted unloaded
+  char file[4096];
+  test_module(path, sizeof(path), "beta");
+  snprintf(file, sizeof(file), "%s/beta.so", dir);
+  test_replace(path, file);
+  TEST_EQUAL(settle(&watch), 1);
+  TEST_EQUAL(loaded, 3);
+  TEST_EQUAL(test_int(micro_module_get(&mm, "beta"), "inits"), 1);
+
+  snprintf(path, sizeof(path), "%s/alpha.so", dir);
+  TEST_ASSERT(unlink(path) == 0);
+  TEST_EQUAL(settle(&watch), 1);
+  TEST_EQUAL(loaded, 2);
+  TEST_ASSERT(micro_module_get(&mm, "alpha") == NULL);
+
+  // Files that are not modules are reported
+  snprintf(path, sizeof(path), "%s/notes.txt", dir);
+  FILE *notes = fopen(path, "w");
+  TEST_ASSERT(notes != NULL);
+  fputs("not a module\n", notes);
+  fclose(notes);
+  TEST_EQUAL(settle(&watch), 0);
+  TEST_ASSERT(skipped >= 1);
+
+  micro_module_watch_close(&watch);
+  TEST_EQUAL(micro_module_exit_all(&mm, &loaded), MICRO_MODULE_OK);
+  TEST_EQUAL(loaded, 0);
+  test_dir_remove(dir);
+  return 0;
+}
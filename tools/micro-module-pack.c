@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: MIT
+//
+// Packs module files into a bundle for micro_module_init_bundle
+//
+// Usage: micro-module-pack [-n name_symbol] [-i init_symbol]
+//                          [-e exit_symbol] <bundle> <module.so>...
+//
+// The symbols default to micro_module_name, micro_module_init and
+// micro_module_exit. The bundle is replaced atomically.
+
+#define MICRO_MODULE_IMPLEMENTATION
+#include "../micro-module.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static void usage(const char *program)
+{
+  fprintf(stderr,
+          "usage: %s [-n name_symbol] [-i init_symbol] [-e exit_symbol]"
+          " <bundle> <module.so>...\n", program);
+}
+
+int main(int argc, char **argv)
+{
+  const char *name_symbol = "micro_module_name";
+  const char *init_symbol = "micro_module_init";
+  const char *exit_symbol = "micro_module_exit";
+  int opt;
+  while ((opt = getopt(argc, argv, "n:i:e:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n': name_symbol = optarg; break;
+    case 'i': init_symbol = optarg; break;
+    case 'e': exit_symbol = optarg; break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind < 2)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  MicroModule mm =
+    micro_module_setup(name_symbol, init_symbol, exit_symbol, false);
+  const char *bundle = argv[optind];
+  const char *const *files = (const char *const *)&argv[optind + 1];
+  size_t count = (size_t)(argc - optind - 1);
+  int err = micro_module_write_bundle(&mm, bundle, files, count);
+  if (err != MICRO_MODULE_OK)
+  {
+    fprintf(stderr, "%s: cannot write %s, error %d\n", argv[0], bundle, err);
+    return 1;
+  }
+  printf("%s: %zu modules\n", bundle, count);
+  return 0;
+}